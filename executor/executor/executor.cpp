@@ -10,12 +10,13 @@
 using namespace std::chrono_literals;
 
 Executor::Executor(uint32_t num_threads)
-    : queue_(std::make_shared<TasksQueue>()), timer_queue_(std::make_shared<TimerQueue>()) {
+    : queue_(std::make_shared<TasksQueue>(num_threads)),
+      timer_queue_(std::make_shared<TimerQueue>()) {
     for (size_t i = 0; i < num_threads + 1; ++i) {
         if (i < num_threads) {
-            threads_.emplace_back([tasks_queue = queue_]() {
+            threads_.emplace_back([tasks_queue = queue_, i]() {
                 std::shared_ptr<Task> task = nullptr;
-                while ((task = tasks_queue->Pop())) {
+                while ((task = tasks_queue->Pop(i))) {
                     if (task->IsCanceled()) {
                         continue;
                     }
@@ -73,35 +74,67 @@ Executor::~Executor() {
     WaitShutdown();
 }
 
+Task::~Task() {
+    if (auto* waiter = waiters_.load(); waiter != Finished()) {
+        while (waiter) {
+            delete std::exchange(waiter, waiter->next);
+        }
+    }
+    ReleaseInputs();
+}
+
 void Task::AddDependency(std::shared_ptr<Task> dep) {
-    dep->AddDepended(shared_from_this());
-    dependencies_.emplace_back(std::move(dep));
     has_dependencies_ = true;
+    AddInput(dep);
+    dep->AddDepended(shared_from_this());
 }
 
 void Task::AddDepended(std::shared_ptr<Task> dep) {
-    std::lock_guard lock(edit_task_);
-    if (!IsFinished()) {
-        ++dep->dependecies_cnt_;
-        depended_.emplace_back(dep);
+    auto& dependecies_cnt = dep->dependecies_cnt_;
+    ++dependecies_cnt;
+    if (!AddWaiter(std::move(dep), false)) {
+        --dependecies_cnt;
     }
 }
 
 void Task::AddTrigger(std::shared_ptr<Task> dep) {
-    dep->AddTriggered(shared_from_this());
-    triggers_.emplace_back(std::move(dep));
     has_triggers_ = true;
+    AddInput(dep);
+    dep->AddTriggered(shared_from_this());
 }
 
 void Task::AddTriggered(std::shared_ptr<Task> dep) {
-    std::lock_guard lock(edit_task_);
-    if (!IsFinished()) {
-        triggered_.emplace_back(dep);
-    } else {
+    if (!AddWaiter(dep, true)) {
         dep->triggers_activated_.test_and_set();
     }
 }
 
+// Returns false if the task has already finished.
+bool Task::AddWaiter(std::weak_ptr<Task> task, bool trigger) {
+    auto* head = waiters_.load();
+    if (head == Finished()) {
+        return false;
+    }
+    auto* waiter = new Waiter{std::move(task), trigger, head};
+    while (!waiters_.compare_exchange_weak(waiter->next, waiter)) {
+        if (waiter->next == Finished()) {
+            delete waiter;
+            return false;
+        }
+    }
+    return true;
+}
+
+void Task::AddInput(std::shared_ptr<Task> task) {
+    inputs_ = new Input{std::move(task), inputs_};
+}
+
+void Task::ReleaseInputs() {
+    while (inputs_) {
+        delete std::exchange(inputs_, inputs_->next);
+    }
+}
+
 void Task::SetTimeTrigger(std::chrono::system_clock::time_point at) {
     has_time_trigger_ = true;
     start_at_ = at;
@@ -164,24 +197,21 @@ bool Task::IsFinished() const {
 }
 
 void Task::OnFinished() {
-    std::lock_guard lock(edit_task_);
-    for (auto& task : depended_) {
-        if (!task.expired()) {
-            auto task_ptr = task.lock();
-            --task_ptr->dependecies_cnt_;
-            task_ptr->TryToEnque();
-        }
+    auto* waiter = waiters_.exchange(Finished());
+    if (waiter == Finished()) {
+        waiter = nullptr;
     }
-    depended_.clear();
-
-    for (auto& task : triggered_) {
-        if (!task.expired()) {
-            auto task_ptr = task.lock();
-            task_ptr->triggers_activated_.test_and_set();
-            task_ptr->TryToEnque();
+    while (waiter) {
+        if (auto task = waiter->task.lock()) {
+            if (waiter->trigger) {
+                task->triggers_activated_.test_and_set();
+            } else {
+                --task->dependecies_cnt_;
+            }
+            task->TryToEnque();
         }
+        delete std::exchange(waiter, waiter->next);
     }
-    triggered_.clear();
 
     state_.notify_all();
 }
@@ -201,8 +231,7 @@ void Task::Enque() {
     if (!queue_.expired()) {
         if (state_.compare_exchange_strong(old_state, TaskStates::Enqueued)) {
             auto queue = queue_.lock();
-            dependencies_.clear();
-            triggers_.clear();
+            ReleaseInputs();
             queue->Push(shared_from_this());
         }
     }
@@ -239,40 +268,255 @@ void Task::Wait() {
     }
 }
 
+WorkStealingDeque::Buffer::Buffer(size_t capacity)
+    : mask(capacity - 1), slots(std::make_unique<std::atomic<Task*>[]>(capacity)) {
+}
+
+WorkStealingDeque::WorkStealingDeque() {
+    buffer_.store(buffers_.emplace_back(std::make_unique<Buffer>(kInitialCapacity)).get());
+}
+
+void WorkStealingDeque::Push(Task* task) {
+    const auto bottom = bottom_.load(std::memory_order_relaxed);
+    const auto top = top_.load(std::memory_order_acquire);
+    auto* buffer = buffer_.load(std::memory_order_relaxed);
+    if (bottom - top > static_cast<int64_t>(buffer->mask)) {
+        buffer = Grow(buffer, top, bottom);
+    }
+    buffer->slots[bottom & buffer->mask].store(task, std::memory_order_relaxed);
+    // Sequentially consistent, so that TasksQueue::Push sees a worker that went to sleep
+    // without noticing this task.
+    bottom_.store(bottom + 1);
+}
+
+Task* WorkStealingDeque::Take() {
+    const auto bottom = bottom_.load(std::memory_order_relaxed) - 1;
+    auto* buffer = buffer_.load(std::memory_order_relaxed);
+    // The store has to be ordered before the load of top_, or a thief and the owner may both
+    // get the last task.
+    bottom_.store(bottom);
+    auto top = top_.load();
+    if (top > bottom) {
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task* task = buffer->slots[bottom & buffer->mask].load(std::memory_order_relaxed);
+    if (top == bottom) {
+        // The last task, thieves race for it as well.
+        if (!top_.compare_exchange_strong(top, top + 1)) {
+            task = nullptr;
+        }
+        bottom_.store(bottom + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+Task* WorkStealingDeque::Steal() {
+    auto top = top_.load();
+    const auto bottom = bottom_.load();
+    if (top >= bottom) {
+        return nullptr;
+    }
+    auto* buffer = buffer_.load(std::memory_order_acquire);
+    Task* task = buffer->slots[top & buffer->mask].load(std::memory_order_relaxed);
+    return top_.compare_exchange_strong(top, top + 1) ? task : nullptr;
+}
+
+bool WorkStealingDeque::Empty() const {
+    return top_.load() >= bottom_.load();
+}
+
+WorkStealingDeque::Buffer* WorkStealingDeque::Grow(Buffer* buffer, int64_t top, int64_t bottom) {
+    auto bigger = std::make_unique<Buffer>(2 * (buffer->mask + 1));
+    for (auto i = top; i < bottom; ++i) {
+        bigger->slots[i & bigger->mask].store(
+            buffer->slots[i & buffer->mask].load(std::memory_order_relaxed),
+            std::memory_order_relaxed);
+    }
+    buffer = buffers_.emplace_back(std::move(bigger)).get();
+    buffer_.store(buffer, std::memory_order_release);
+    return buffer;
+}
+
+namespace {
+
+// The queue and the index of the worker running on this thread.
+struct CurrentWorker {
+    const TasksQueue* queue = nullptr;
+    size_t index = 0;
+};
+
+thread_local CurrentWorker current_worker;
+
+}  // namespace
+
+TasksQueue::TasksQueue(size_t num_workers) {
+    for (size_t i = 0; i < num_workers; ++i) {
+        auto& worker = workers_.emplace_back(std::make_unique<Worker>());
+        worker->random = static_cast<uint32_t>(i) * 2654435761u | 1;
+    }
+}
+
+TasksQueue::~TasksQueue() {
+    for (auto& worker : workers_) {
+        while (Task* task = worker->deque.Steal()) {
+            task->queued_self_.reset();
+        }
+    }
+}
+
 void TasksQueue::Push(std::shared_ptr<Task> task) {
-    if (!closed_.test()) {
+    if (closed_.test()) {
+        task->Cancel();
+        return;
+    }
+
+    if (current_worker.queue == this) {
+        Task* raw = task.get();
+        raw->queued_self_ = std::move(task);
+        workers_[current_worker.index]->deque.Push(raw);
+        WakeWorker();
+        return;
+    }
+
+    {
         std::lock_guard lock(edit_queue_);
-        queue_.emplace_back(std::move(task));
-        waiting_pop_.notify_one();
-    } else {
+        if (!closed_.test()) {
+            injected_.emplace_back(std::move(task));
+            ++injected_size_;
+            if (sleeping_.load()) {
+                waiting_pop_.notify_one();
+            }
+            return;
+        }
+    }
+    // Outside the lock, as cancellation may push the dependent tasks.
+    task->Cancel();
+}
+
+std::shared_ptr<Task> TasksQueue::Pop(size_t worker) {
+    current_worker = {this, worker};
+    auto woken = false;
+    while (true) {
+        auto task = FindTask(worker);
+        if (std::exchange(woken, false)) {
+            // Tasks pushed since the wakeup are visible to the checks that follow the reset.
+            waking_.store(false);
+            if (task && HasStealable()) {
+                WakeWorker();
+            }
+        }
+        if (task) {
+            return task;
+        }
+
+        // A pusher loads sleeping_ after publishing its task, so either it sees this worker
+        // asleep and notifies it, or this worker sees the task below.
+        std::unique_lock lock(edit_queue_);
+        ++sleeping_;
+        if (injected_.empty() && !HasStealable()) {
+            if (closed_.test()) {
+                --sleeping_;
+                return nullptr;
+            }
+            waiting_pop_.wait(lock);
+            woken = true;
+        }
+        --sleeping_;
+    }
+}
+
+void TasksQueue::Close() {
+    std::deque<std::shared_ptr<Task>> injected;
+    {
+        std::lock_guard lock(edit_queue_);
+        if (closed_.test_and_set()) {
+            return;
+        }
+        injected.swap(injected_);
+        injected_size_ = 0;
+        waiting_pop_.notify_all();
+    }
+
+    for (auto& task : injected) {
         task->Cancel();
     }
+    for (auto& worker : workers_) {
+        while (Task* task = worker->deque.Steal()) {
+            std::shared_ptr<Task>(std::move(task->queued_self_))->Cancel();
+        }
+    }
 }
 
-std::shared_ptr<Task> TasksQueue::Pop() {
-    std::unique_lock lock(edit_queue_);
-    waiting_pop_.wait(lock, [this] { return closed_.test() || !queue_.empty(); });
+std::shared_ptr<Task> TasksQueue::FindTask(size_t worker) {
+    auto& own = *workers_[worker];
+    if (++own.pops % kInjectionInterval == 0) {
+        if (auto task = PopInjected()) {
+            return task;
+        }
+    }
+    if (Task* task = own.deque.Take()) {
+        return std::move(task->queued_self_);
+    }
+    if (auto task = PopInjected()) {
+        return task;
+    }
+    return Steal(worker);
+}
 
-    if (queue_.empty()) {
+std::shared_ptr<Task> TasksQueue::PopInjected() {
+    if (!injected_size_.load(std::memory_order_relaxed)) {
         return nullptr;
     }
-
-    std::shared_ptr<Task> task(std::move(queue_.front()));
-    queue_.pop_front();
+    std::lock_guard lock(edit_queue_);
+    if (injected_.empty()) {
+        return nullptr;
+    }
+    auto task = std::move(injected_.front());
+    injected_.pop_front();
+    --injected_size_;
     return task;
 }
 
-void TasksQueue::Close() {
-    if (!closed_.test_and_set()) {
-        std::lock_guard lock(edit_queue_);
-        for (auto& task : queue_) {
-            task->Cancel();
+// Victims are tried in order, starting from a random one.
+std::shared_ptr<Task> TasksQueue::Steal(size_t worker) {
+    auto& random = workers_[worker]->random;
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+    const auto start = random % workers_.size();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        const auto victim = (start + i) % workers_.size();
+        if (victim == worker) {
+            continue;
+        }
+        if (Task* task = workers_[victim]->deque.Steal()) {
+            return std::move(task->queued_self_);
         }
+    }
+    return nullptr;
+}
 
-        waiting_pop_.notify_all();
+// Sleepers are counted under the mutex until they return from the wait, so with sleeping_
+// positive there is a worker that will wake up and reset waking_ after its next search.
+void TasksQueue::WakeWorker() {
+    if (!sleeping_.load() || waking_.exchange(true)) {
+        return;
+    }
+    std::lock_guard lock(edit_queue_);
+    if (sleeping_.load()) {
+        waiting_pop_.notify_one();
+    } else {
+        waking_.store(false);
     }
 }
 
+bool TasksQueue::HasStealable() const {
+    return std::ranges::any_of(workers_,
+                               [](const auto& worker) { return !worker->deque.Empty(); });
+}
+
 void TimerQueue::Push(std::shared_ptr<Task> task) {
     if (!closed_.test()) {
         std::lock_guard lock(edit_queue_);
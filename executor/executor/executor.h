@@ -1,7 +1,9 @@
 #pragma once
 
 #include <sys/types.h>
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <condition_variable>
 #include <deque>
 #include <memory>
@@ -12,6 +14,10 @@
 #include <vector>
 #include <functional>
 #include <exception>
+#include <concepts>
+#include <cstddef>
+#include <new>
+#include <type_traits>
 
 enum class TaskStates : u_char {
     Created = 0,
@@ -24,11 +30,100 @@ enum class TaskStates : u_char {
 
 class TasksQueue;
 
-class Task : public std::enable_shared_from_this<Task> {
+// Fixed size blocks cached per thread, so that a steady stream of tasks does not go to the heap.
+// A block freed by another thread joins the cache of that thread. Each thread keeps at most
+// kMaxCached blocks, since a thread that only frees blocks of others would hoard them.
+template <size_t Size, size_t Align>
+class BlockPool {
 public:
-    virtual ~Task() {
+    static void* Allocate() {
+        if (!cache_destroyed) {
+            auto& cache = Cache();
+            if (Block* block = cache.head) {
+                cache.head = block->next;
+                --cache.size;
+                return block;
+            }
+        }
+        return ::operator new(kSize, std::align_val_t{Align});
+    }
+
+    static void Deallocate(void* ptr) {
+        if (!cache_destroyed) {
+            if (auto& cache = Cache(); cache.size < kMaxCached) {
+                cache.head = new (ptr) Block{cache.head};
+                ++cache.size;
+                return;
+            }
+        }
+        ::operator delete(ptr, std::align_val_t{Align});
+    }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    static constexpr size_t kSize = std::max(Size, sizeof(Block));
+    static constexpr size_t kMaxCached = 1024;
+
+    struct ThreadCache {
+        ~ThreadCache() {
+            cache_destroyed = true;
+            while (head) {
+                ::operator delete(std::exchange(head, head->next), std::align_val_t{Align});
+            }
+        }
+
+        Block* head = nullptr;
+        size_t size = 0;
+    };
+
+    static ThreadCache& Cache() {
+        thread_local ThreadCache cache;
+        return cache;
+    }
+
+    // Blocks freed by thread_local destructors that run after the cache go to the heap.
+    static inline thread_local bool cache_destroyed = false;
+};
+
+// Allocator for std::allocate_shared, the object and its control block come from a BlockPool.
+template <class T>
+struct PoolAllocator {
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        if (n != 1) {
+            return std::allocator<T>{}.allocate(n);
+        }
+        return static_cast<T*>(BlockPool<sizeof(T), alignof(T)>::Allocate());
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if (n != 1) {
+            std::allocator<T>{}.deallocate(ptr, n);
+        } else {
+            BlockPool<sizeof(T), alignof(T)>::Deallocate(ptr);
+        }
     }
 
+    template <class U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+};
+
+class Task : public std::enable_shared_from_this<Task> {
+public:
+    virtual ~Task();
+
     virtual void Run() = 0;
 
     void AddDependency(std::shared_ptr<Task> dep);
@@ -70,32 +165,137 @@ public:
     void Wait();
 
 private:
+    // Entry of the intrusive list of tasks that wait for this one, as dependencies or triggers.
+    // The waiting task is not owned: it may hold this one, and a task that is never finished
+    // must not keep its dependents alive.
+    struct Waiter {
+        static void* operator new(size_t) {
+            return BlockPool<sizeof(Waiter), alignof(Waiter)>::Allocate();
+        }
+        static void operator delete(void* ptr) {
+            BlockPool<sizeof(Waiter), alignof(Waiter)>::Deallocate(ptr);
+        }
+
+        std::weak_ptr<Task> task;
+        bool trigger;
+        Waiter* next = nullptr;
+    };
+
+    // Entry of the list of tasks this one waits for. They are owned until this task is
+    // enqueued, as their waiter lists do not own it. Filled before Submit, so unsynchronized.
+    struct Input {
+        static void* operator new(size_t) {
+            return BlockPool<sizeof(Input), alignof(Input)>::Allocate();
+        }
+        static void operator delete(void* ptr) {
+            BlockPool<sizeof(Input), alignof(Input)>::Deallocate(ptr);
+        }
+
+        std::shared_ptr<Task> task;
+        Input* next = nullptr;
+    };
+
+    // Replaces the list head once OnFinished has taken the list, no waiter is added after it.
+    static Waiter* Finished() {
+        alignas(Waiter) static char finished;
+        return reinterpret_cast<Waiter*>(&finished);
+    }
+
+    bool AddWaiter(std::weak_ptr<Task> task, bool trigger);
+    void AddInput(std::shared_ptr<Task> task);
+    void ReleaseInputs();
+
     std::atomic<TaskStates> state_ = TaskStates::Created;
     std::weak_ptr<TasksQueue> queue_;
-    std::mutex edit_task_;
 
-    std::vector<std::shared_ptr<Task>> dependencies_;
-    std::vector<std::weak_ptr<Task>> depended_;
+    std::atomic<Waiter*> waiters_ = nullptr;
+    Input* inputs_ = nullptr;
     std::atomic_size_t dependecies_cnt_ = 0;
     bool has_dependencies_ = false;
-    std::vector<std::shared_ptr<Task>> triggers_;
-    std::vector<std::weak_ptr<Task>> triggered_;
     bool has_triggers_ = false;
     std::atomic_flag triggers_activated_;
     std::chrono::system_clock::time_point start_at_;
     bool has_time_trigger_ = false;
 
     std::exception_ptr exc_ptr_;
+
+    // Keeps the task alive while a worker deque holds it by raw pointer.
+    friend class TasksQueue;
+    std::shared_ptr<Task> queued_self_;
+};
+
+// Chase-Lev deque. The owner pushes and takes tasks at the bottom, other threads steal from the
+// top. Replaced buffers are kept until the deque is destroyed, because a thief may still read
+// from them.
+class WorkStealingDeque {
+public:
+    WorkStealingDeque();
+
+    // Owner only.
+    void Push(Task* task);
+    Task* Take();
+
+    // Returns nullptr if the deque is empty or another thread has taken the top task first.
+    Task* Steal();
+    bool Empty() const;
+
+private:
+    struct Buffer {
+        explicit Buffer(size_t capacity);
+
+        const size_t mask;
+        std::unique_ptr<std::atomic<Task*>[]> slots;
+    };
+
+    Buffer* Grow(Buffer* buffer, int64_t top, int64_t bottom);
+
+    static constexpr size_t kInitialCapacity = 256;
+
+    alignas(64) std::atomic<int64_t> top_ = 0;
+    alignas(64) std::atomic<int64_t> bottom_ = 0;
+    std::atomic<Buffer*> buffer_;
+    std::vector<std::unique_ptr<Buffer>> buffers_;
 };
 
+// Work-stealing scheduler. Tasks that become ready on a worker thread go to the deque of that
+// worker, which takes them back in LIFO order, while idle workers steal the oldest ones. Tasks
+// from other threads go to the shared injection queue.
 class TasksQueue {
 public:
+    explicit TasksQueue(size_t num_workers);
+    ~TasksQueue();
+
     void Push(std::shared_ptr<Task> task);
-    std::shared_ptr<Task> Pop();
+    // Called by the worker with the given index. Returns nullptr once the queue is closed and
+    // no task is left.
+    std::shared_ptr<Task> Pop(size_t worker);
     void Close();
 
 private:
-    std::deque<std::shared_ptr<Task>> queue_;
+    struct alignas(64) Worker {
+        WorkStealingDeque deque;
+        uint32_t random;
+        size_t pops = 0;
+    };
+
+    std::shared_ptr<Task> FindTask(size_t worker);
+    std::shared_ptr<Task> PopInjected();
+    std::shared_ptr<Task> Steal(size_t worker);
+    bool HasStealable() const;
+    void WakeWorker();
+
+    // A worker looks at the injection queue first on every such pop, so that tasks spawned by
+    // workers cannot starve the submitted ones.
+    static constexpr size_t kInjectionInterval = 61;
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::deque<std::shared_ptr<Task>> injected_;
+    std::atomic_size_t injected_size_ = 0;
+    std::atomic_size_t sleeping_ = 0;
+    // Set while a notified worker has not looked for tasks yet. Pushes from workers skip the
+    // wakeup then, and that worker passes it on once it finds a task, so a burst of spawns
+    // takes the mutex about once per woken worker instead of once per task.
+    std::atomic_bool waking_ = false;
     std::mutex edit_queue_;
     std::condition_variable waiting_pop_;
     std::atomic_flag closed_;
@@ -134,11 +334,11 @@ public:
     void StartShutdown();
     void WaitShutdown();
 
-    template <class T>
-    FuturePtr<T> Invoke(std::function<T()> fn);
+    template <class T, class F>
+    FuturePtr<T> Invoke(F&& fn);
 
-    template <class Y, class T>
-    FuturePtr<Y> Then(FuturePtr<T> input, std::function<Y()> fn);
+    template <class Y, class T, class F>
+    FuturePtr<Y> Then(FuturePtr<T> input, F&& fn);
 
     template <class T>
     FuturePtr<std::vector<T>> WhenAll(std::vector<FuturePtr<T>> all);
@@ -158,20 +358,70 @@ private:
 
 std::shared_ptr<Executor> MakeThreadPoolExecutor(uint32_t num_threads);
 
+// Callable returning T, stored in place when it fits into kInlineSize bytes. Lambdas passed to
+// Invoke and Then usually do, so a future is a single pooled allocation.
+template <class T>
+class InlineFunction {
+public:
+    template <class F>
+        requires std::is_invocable_r_v<T, std::decay_t<F>&>
+    InlineFunction(F&& fn) {
+        using Fn = std::decay_t<F>;
+        if constexpr (sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t)) {
+            new (storage_) Fn(std::forward<F>(fn));
+            invoke_ = [](void* storage) -> T { return (*static_cast<Fn*>(storage))(); };
+            destroy_ = [](void* storage) { static_cast<Fn*>(storage)->~Fn(); };
+        } else {
+            new (storage_) Fn*(new Fn(std::forward<F>(fn)));
+            invoke_ = [](void* storage) -> T { return (**static_cast<Fn**>(storage))(); };
+            destroy_ = [](void* storage) { delete *static_cast<Fn**>(storage); };
+        }
+    }
+
+    InlineFunction(const InlineFunction&) = delete;
+    InlineFunction& operator=(const InlineFunction&) = delete;
+
+    ~InlineFunction() {
+        Reset();
+    }
+
+    T operator()() {
+        return invoke_(storage_);
+    }
+
+    // Destroys the callable along with everything it captured.
+    void Reset() {
+        if (destroy_) {
+            std::exchange(destroy_, nullptr)(storage_);
+        }
+    }
+
+private:
+    static constexpr size_t kInlineSize = 48;
+
+    alignas(std::max_align_t) std::byte storage_[kInlineSize];
+    T (*invoke_)(void*);
+    void (*destroy_)(void*);
+};
+
 template <class T>
 class Future : public Task {
 public:
-    Future(std::function<T()> fn);
+    template <class F>
+        requires std::is_invocable_r_v<T, std::decay_t<F>&>
+    Future(F&& fn);
     T Get();
     void Run() override;
 
 private:
-    std::function<T()> func_;
+    InlineFunction<T> func_;
     T result_;
 };
 
 template <class T>
-Future<T>::Future(std::function<T()> fn) : func_(std::move(fn)) {
+template <class F>
+    requires std::is_invocable_r_v<T, std::decay_t<F>&>
+Future<T>::Future(F&& fn) : func_(std::forward<F>(fn)) {
 }
 
 template <class T>
@@ -186,21 +436,34 @@ T Future<T>::Get() {
     }
 }
 
+// The callable goes away right after the run, and with it the futures it has captured.
 template <class T>
 void Future<T>::Run() {
+    struct ResetGuard {
+        ~ResetGuard() {
+            func->Reset();
+        }
+        InlineFunction<T>* func;
+    } guard{&func_};
     result_ = func_();
 }
 
-template <class T>
-FuturePtr<T> Executor::Invoke(std::function<T()> fn) {
-    auto fut_ptr = std::make_shared<Future<T>>(fn);
+template <class T, class... Args>
+FuturePtr<T> MakeFuture(Args&&... args) {
+    return std::allocate_shared<Future<T>>(PoolAllocator<Future<T>>{},
+                                           std::forward<Args>(args)...);
+}
+
+template <class T, class F>
+FuturePtr<T> Executor::Invoke(F&& fn) {
+    auto fut_ptr = MakeFuture<T>(std::forward<F>(fn));
     Submit(fut_ptr);
     return fut_ptr;
 }
 
-template <class Y, class T>
-FuturePtr<Y> Executor::Then(FuturePtr<T> input, std::function<Y()> fn) {
-    auto fut_ptr = std::make_shared<Future<Y>>(fn);
+template <class Y, class T, class F>
+FuturePtr<Y> Executor::Then(FuturePtr<T> input, F&& fn) {
+    auto fut_ptr = MakeFuture<Y>(std::forward<F>(fn));
     fut_ptr->AddDependency(std::move(input));
     Submit(fut_ptr);
     return fut_ptr;
@@ -208,7 +471,7 @@ FuturePtr<Y> Executor::Then(FuturePtr<T> input, std::function<Y()> fn) {
 
 template <class T>
 FuturePtr<std::vector<T>> Executor::WhenAll(std::vector<FuturePtr<T>> all) {
-    auto fut_ptr = std::make_shared<Future<std::vector<T>>>([all]() -> std::vector<T> {
+    auto fut_ptr = MakeFuture<std::vector<T>>([all]() -> std::vector<T> {
         std::vector<T> res;
         for (auto& fut : all) {
             res.emplace_back(fut->Get());
@@ -227,7 +490,7 @@ FuturePtr<std::vector<T>> Executor::WhenAll(std::vector<FuturePtr<T>> all) {
 
 template <class T>
 FuturePtr<T> Executor::WhenFirst(std::vector<FuturePtr<T>> all) {
-    auto fut_ptr = std::make_shared<Future<T>>([all]() -> T {
+    auto fut_ptr = MakeFuture<T>([all]() -> T {
         for (auto& fut : all) {
             if (fut->IsFinished()) {
                 return fut->Get();
@@ -248,7 +511,7 @@ FuturePtr<T> Executor::WhenFirst(std::vector<FuturePtr<T>> all) {
 template <class T>
 FuturePtr<std::vector<T>> Executor::WhenAllBeforeDeadline(
     std::vector<FuturePtr<T>> all, std::chrono::system_clock::time_point deadline) {
-    auto fut_ptr = std::make_shared<Future<std::vector<T>>>([all]() -> std::vector<T> {
+    auto fut_ptr = MakeFuture<std::vector<T>>([all]() -> std::vector<T> {
         std::vector<T> res;
         for (auto& fut : all) {
             if (fut->IsFinished()) {
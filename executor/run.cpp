@@ -29,6 +29,29 @@ private:
     std::latch* latch_;
 };
 
+// Spawns a binary tree of tasks from the workers, leaves count down the latch.
+class SpawningTask : public Task {
+public:
+    SpawningTask(uint32_t depth, Executor* executor, std::latch* latch)
+        : depth_{depth}, executor_{executor}, latch_{latch} {
+    }
+
+    void Run() override {
+        if (!depth_) {
+            latch_->count_down();
+            return;
+        }
+        for (auto i = 0; i < 2; ++i) {
+            executor_->Submit(std::make_shared<SpawningTask>(depth_ - 1, executor_, latch_));
+        }
+    }
+
+private:
+    const uint32_t depth_;
+    Executor* const executor_;
+    std::latch* latch_;
+};
+
 }  // namespace
 
 TEST_CASE("Simple") {
@@ -82,3 +105,30 @@ TEST_CASE("ScalableTimers") {
         latch.wait();
     };
 }
+
+TEST_CASE("Spawn") {
+    static constexpr auto kDepth = 12;
+    const auto num_threads = GENERATE(1, 2, 10, 16);
+    auto pool = MakeThreadPoolExecutor(num_threads);
+
+    BENCHMARK("Spawn:" + std::to_string(num_threads)) {
+        std::latch latch{1 << kDepth};
+        pool->Submit(std::make_shared<SpawningTask>(kDepth, pool.get(), &latch));
+        latch.wait();
+    };
+}
+
+TEST_CASE("Futures") {
+    static constexpr auto kCount = 100;
+    const auto num_threads = GENERATE(1, 2, 10);
+    auto pool = MakeThreadPoolExecutor(num_threads);
+
+    BENCHMARK("Futures:" + std::to_string(num_threads)) {
+        std::vector<FuturePtr<int>> all;
+        for (auto i = 0; i < kCount; ++i) {
+            auto future = pool->Invoke<int>([i] { return i; });
+            all.push_back(pool->Then<int>(future, [future] { return future->Get() + 1; }));
+        }
+        return pool->WhenAll(std::move(all))->Get().size();
+    };
+}
@@ -88,6 +88,29 @@ private:
     const std::shared_ptr<Executor> executor_;
 };
 
+// Submits its children from the worker and blocks until they finish, so that other workers have
+// to steal them.
+struct WaitingParentTask : Task {
+    WaitingParentTask(uint32_t num_children, Executor* executor)
+        : num_children_{num_children}, executor_{executor} {
+    }
+
+    void Run() override {
+        for (auto i = 0u; i < num_children_; ++i) {
+            executor_->Submit(children.emplace_back(std::make_shared<TestTask>()));
+        }
+        for (const auto& child : children) {
+            child->Wait();
+        }
+    }
+
+    std::vector<std::shared_ptr<TestTask>> children;
+
+private:
+    const uint32_t num_children_;
+    Executor* const executor_;
+};
+
 auto Now() {
     return std::chrono::system_clock::now();
 }
@@ -527,3 +550,15 @@ TEST("WaitInManyThreads") {
 
     threads.clear();
 }
+
+TEMPLATE_TEST_CASE_SIG("StealFromBlockedWorker", "", ((uint32_t N), N), 2, 10) {
+    auto pool = MakeThreadPoolExecutor(N);
+    auto task = std::make_shared<WaitingParentTask>(100, pool.get());
+    pool->Submit(task);
+    task->Wait();
+
+    CHECK_MT(task->IsCompleted());
+    for (const auto& child : task->children) {
+        CHECK_MT(child->completed);
+    }
+}
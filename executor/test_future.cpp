@@ -7,6 +7,7 @@
 #include <ranges>
 #include <numeric>
 #include <random>
+#include <array>
 
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/catch_template_test_macros.hpp>
@@ -60,6 +61,16 @@ TEST("InvokeException") {
     CHECK_THROWS_MATCHES_MT(future->Get(), std::logic_error, Catch::Matchers::Message(kMessage));
 }
 
+TEST("InvokeLargeClosure") {
+    auto pool = MakeThreadPoolExecutor(N);
+    std::array<int, 64> values;
+    std::iota(values.begin(), values.end(), 0);
+    auto future = pool->Invoke<int>(
+        [values] { return std::accumulate(values.begin(), values.end(), 0); });
+
+    CHECK_MT(future->Get() == 63 * 64 / 2);
+}
+
 TEST("Then") {
     auto pool = MakeThreadPoolExecutor(N);
     auto future_a = pool->Invoke<std::string>([] { return "Foo Bar"; });
@@ -89,6 +100,38 @@ TEST("ThenCanCancel") {
     CHECK_MT(res_future->IsCanceled());
 }
 
+TEST("ThenChainWithoutReferences") {
+    auto pool = MakeThreadPoolExecutor(N);
+    std::atomic_flag release;
+    auto first = pool->Invoke<int>([&release] {
+        release.wait(false);
+        return 1;
+    });
+    auto last = pool->Then<int>(pool->Then<int>(first, [first] { return first->Get() + 1; }),
+                                [] { return 3; });
+    first.reset();
+
+    release.test_and_set();
+    release.notify_one();
+    CHECK_MT(last->Get() == 3);
+}
+
+TEST("ThenOnUnfinishedFutureIsFreed") {
+    auto pool = MakeThreadPoolExecutor(N);
+    // Never submitted, so it never finishes.
+    auto input = MakeFuture<int>([] { return 1; });
+    std::weak_ptr<Future<int>> weak_input = input;
+    auto then = pool->Then<int>(input, [input] { return input->Get(); });
+    auto all = pool->WhenAll(std::vector{input});
+    std::weak_ptr<Future<int>> weak_then = then;
+
+    input.reset();
+    then.reset();
+    all.reset();
+    CHECK_MT(weak_then.expired());
+    CHECK_MT(weak_input.expired());
+}
+
 TEST("ThenIsNonBlocking") {
     auto pool = MakeThreadPoolExecutor(N);
     auto start = Now();
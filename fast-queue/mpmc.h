@@ -1,74 +1,351 @@
 #pragma once
 
+#include <algorithm>
 #include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <span>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
 #include <vector>
 
+#include "spsc.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// kPadded gives every slot its own pair of cache lines, kCompact packs slots of small types
+// several to a line and spreads consecutive positions over different lines.
+enum class SlotLayout { kPadded, kCompact };
+
+// Allocates at cache line boundaries at least, so that the slot layout matches the lines.
 template <class T>
+struct CacheLineAllocator {
+    using value_type = T;
+
+    static constexpr std::align_val_t kAlignment{std::max<size_t>(64, alignof(T))};
+
+    CacheLineAllocator() = default;
+
+    template <class U>
+    CacheLineAllocator(const CacheLineAllocator<U>&) {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), kAlignment));
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        ::operator delete(ptr, n * sizeof(T), kAlignment);
+    }
+
+    template <class U>
+    bool operator==(const CacheLineAllocator<U>&) const {
+        return true;
+    }
+};
+
+// kSingle promises exactly one producer and one consumer thread and turns the queue into the
+// SPSC ring, which needs no CAS. That ring has no per-slot state, so the layout does not apply.
+enum class Concurrency { kMultiple, kSingle };
+
+template <class T, SlotLayout kLayout = SlotLayout::kPadded,
+          Concurrency kConcurrency = Concurrency::kMultiple>
 class MPMCBoundedQueue {
 private:
-    struct alignas(128) Element {
+    using Clock = std::chrono::steady_clock;
+
+    struct alignas(128) PaddedElement {
         std::atomic_size_t generation;
         alignas(64) T value;
     };
 
+    struct CompactElement {
+        std::atomic_size_t generation;
+        T value;
+    };
+
+    using Element =
+        std::conditional_t<kLayout == SlotLayout::kPadded, PaddedElement, CompactElement>;
+
 public:
     explicit MPMCBoundedQueue(size_t size)
-        : max_size_(size), bit_mask_(max_size_ - 1), queue_(max_size_) {
+        : max_size_(size),
+          bit_mask_(max_size_ - 1),
+          index_bits_(std::countr_zero(size)),
+          index_shift_(std::min(index_bits_, std::countr_zero(kSlotsPerLine))),
+          queue_(max_size_) {
+        if (!std::has_single_bit(size)) {
+            throw std::invalid_argument{"MPMCBoundedQueue size must be a power of two"};
+        }
         for (size_t i = 0; i < max_size_; ++i) {
-            queue_[i].generation = i;
+            Slot(i).generation = i;
         }
     }
 
     bool Enqueue(const T& value) {
         size_t tail = tail_;
-        size_t index = tail & bit_mask_;
-
-        if (queue_[index].generation.load(std::memory_order_acquire) + bit_mask_ <= tail) {
+        if (!IsFree(tail)) {
             return false;
         }
 
         while (!tail_.compare_exchange_weak(tail, tail + 1, std::memory_order_acquire)) {
             std::this_thread::yield();
-            index = tail & bit_mask_;
-            if (queue_[index].generation.load(std::memory_order_acquire) + bit_mask_ <= tail) {
+            if (!IsFree(tail)) {
                 return false;
             }
         }
 
-        Element& elem = queue_[index];
+        Element& elem = Slot(tail);
         elem.value = value;
-        elem.generation.fetch_add(1u, std::memory_order_release);
+        Publish(elem, 1u, consumers_waiting_);
         return true;
     }
 
     bool Dequeue(T& data) {
         size_t head = head_;
-        size_t index = head & bit_mask_;
-
-        if (queue_[index].generation.load(std::memory_order_acquire) < head + 1) {
+        if (!IsFilled(head)) {
             return false;
         }
 
         while (!head_.compare_exchange_weak(head, head + 1, std::memory_order_acquire)) {
             std::this_thread::yield();
-            index = head & bit_mask_;
-            if (queue_[index].generation.load(std::memory_order_acquire) < head + 1) {
+            if (!IsFilled(head)) {
                 return false;
             }
         }
 
-        Element& elem = queue_[index];
+        Element& elem = Slot(head);
         data = std::move(elem.value);
-        elem.generation.fetch_add(bit_mask_, std::memory_order_release);
+        Publish(elem, bit_mask_, producers_waiting_);
         return true;
     }
 
+    // Enqueues the longest prefix of values that fits, claiming all of its slots with one CAS on
+    // tail_. Returns the number of values enqueued.
+    size_t EnqueueBatch(std::span<const T> values) {
+        size_t tail = tail_;
+        size_t count = CountFree(tail, values.size());
+        while (count && !tail_.compare_exchange_weak(tail, tail + count,
+                                                     std::memory_order_acquire)) {
+            std::this_thread::yield();
+            count = CountFree(tail, values.size());
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            Element& elem = Slot(tail + i);
+            elem.value = values[i];
+            Publish(elem, 1u, consumers_waiting_);
+        }
+        return count;
+    }
+
+    // Dequeues up to max values into out, claiming all of their slots with one CAS on head_.
+    // Returns the number of values dequeued.
+    template <class OutputIt>
+    size_t DequeueBatch(OutputIt out, size_t max) {
+        size_t head = head_;
+        size_t count = CountFilled(head, max);
+        while (count && !head_.compare_exchange_weak(head, head + count,
+                                                     std::memory_order_acquire)) {
+            std::this_thread::yield();
+            count = CountFilled(head, max);
+        }
+
+        for (size_t i = 0; i < count; ++i) {
+            Element& elem = Slot(head + i);
+            *out = std::move(elem.value);
+            ++out;
+            Publish(elem, bit_mask_, producers_waiting_);
+        }
+        return count;
+    }
+
+    // After Close every Enqueue fails and Dequeue drains what is left. A closed tail_ has its top
+    // bit set, so the full check rejects it and no CAS from an older value can succeed.
+    void Close() {
+        tail_.fetch_or(kClosed);
+    }
+
+    // True once the queue is closed and every element in it has been dequeued.
+    bool IsDrained() const {
+        const size_t tail = tail_;
+        return (tail & kClosed) && head_ == (tail & ~kClosed);
+    }
+
+    // Blocking variants: spin on Enqueue/Dequeue for a while, then sleep until the slot at
+    // tail_/head_ changes generation. The timed ones return false once the timeout expires, the
+    // untimed Push never returns on a closed queue.
+    void Push(const T& value) {
+        PushUntil(value, Clock::time_point::max());
+    }
+
+    bool Push(const T& value, Clock::duration timeout) {
+        return PushUntil(value, Clock::now() + timeout);
+    }
+
+    void Pop(T& data) {
+        PopUntil(data, Clock::time_point::max());
+    }
+
+    bool Pop(T& data, Clock::duration timeout) {
+        return PopUntil(data, Clock::now() + timeout);
+    }
+
 private:
+    static constexpr auto kSpinAttempts = 16;
+    static constexpr size_t kSlotsPerLine =
+        std::bit_floor(std::max<size_t>(1, 64 / sizeof(Element)));
+    static constexpr size_t kClosed = size_t{1} << (std::numeric_limits<size_t>::digits - 1);
+
+    bool PushUntil(const T& value, Clock::time_point deadline) {
+        return Block([&] { return Enqueue(value); }, tail_, producers_waiting_,
+                     [this](size_t pos) { return IsFree(pos); }, deadline);
+    }
+
+    bool PopUntil(T& data, Clock::time_point deadline) {
+        return Block([&] { return Dequeue(data); }, head_, consumers_waiting_,
+                     [this](size_t pos) { return IsFilled(pos); }, deadline);
+    }
+
+    // A waiter registers in waiters before it reads the generation it sleeps on, the other side
+    // bumps the generation before it reads waiters. Both are seq_cst, so either the waiter sees
+    // the new generation or Publish sees the waiter and wakes it. With nobody waiting, Publish
+    // makes no syscall.
+    template <class TryOp, class IsReady>
+    bool Block(TryOp try_op, const std::atomic_size_t& position, std::atomic_int& waiters,
+               IsReady is_ready, Clock::time_point deadline) {
+        for (auto i = 0; i < kSpinAttempts; ++i) {
+            if (try_op()) {
+                return true;
+            }
+            std::this_thread::yield();
+        }
+        while (!try_op()) {
+            const size_t pos = position;
+            auto& generation = Slot(pos).generation;
+            ++waiters;
+            const size_t expected = generation;
+            auto timed_out = false;
+            if (!is_ready(pos)) {
+                timed_out = !FutexWait(generation, expected, deadline);
+            }
+            --waiters;
+            if (timed_out) {
+                return try_op();
+            }
+        }
+        return true;
+    }
+
+    void Publish(Element& elem, size_t delta, const std::atomic_int& waiters) {
+        elem.generation.fetch_add(delta);
+        if (waiters.load()) {
+            FutexWake(elem.generation);
+        }
+    }
+
+    // The futex word is the low half of the generation. A sleeper could only miss a wakeup if
+    // the generation moved by a multiple of 2^32 between its read and the syscall.
+    static uint32_t* FutexWord(std::atomic_size_t& generation) {
+        static_assert(std::endian::native == std::endian::little);
+        static_assert(sizeof(std::atomic_size_t) == sizeof(size_t));
+        return reinterpret_cast<uint32_t*>(&generation);
+    }
+
+    // Sleeps while the futex word equals expected. Returns false if the deadline has passed.
+    static bool FutexWait(std::atomic_size_t& generation, size_t expected,
+                          Clock::time_point deadline) {
+        timespec timeout;
+        timespec* timeout_ptr = nullptr;
+        if (deadline != Clock::time_point::max()) {
+            const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                deadline - Clock::now());
+            if (left <= left.zero()) {
+                return false;
+            }
+            timeout.tv_sec = left.count() / 1'000'000'000;
+            timeout.tv_nsec = left.count() % 1'000'000'000;
+            timeout_ptr = &timeout;
+        }
+        return syscall(SYS_futex, FutexWord(generation), FUTEX_WAIT_PRIVATE,
+                       static_cast<uint32_t>(expected), timeout_ptr, nullptr, 0) == 0 ||
+               errno != ETIMEDOUT;
+    }
+
+    // Every sleeper on a slot waits for the same position, so all of them are woken: one gets
+    // the element, the rest move on to the next slot.
+    static void FutexWake(std::atomic_size_t& generation) {
+        syscall(SYS_futex, FutexWord(generation), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr,
+                0);
+    }
+
+    // A slot found free stays free until its position is claimed: only the producer that moves
+    // tail_ past it may fill it. The same holds for filled slots and head_.
+    size_t CountFree(size_t tail, size_t max) const {
+        size_t count = 0;
+        while (count < max && IsFree(tail + count)) {
+            ++count;
+        }
+        return count;
+    }
+
+    size_t CountFilled(size_t head, size_t max) const {
+        size_t count = 0;
+        while (count < max && IsFilled(head + count)) {
+            ++count;
+        }
+        return count;
+    }
+
+    bool IsFree(size_t pos) const {
+        return Slot(pos).generation.load(std::memory_order_acquire) + bit_mask_ > pos;
+    }
+
+    bool IsFilled(size_t pos) const {
+        return Slot(pos).generation.load(std::memory_order_acquire) > pos;
+    }
+
+    // Compact slots: the index bits are rotated left by index_shift_, so that positions next to
+    // each other land kSlotsPerLine slots apart, on different cache lines.
+    size_t Index(size_t pos) const {
+        const size_t index = pos & bit_mask_;
+        if constexpr (kLayout == SlotLayout::kPadded) {
+            return index;
+        } else {
+            return ((index << index_shift_) | (index >> (index_bits_ - index_shift_))) &
+                   bit_mask_;
+        }
+    }
+
+    Element& Slot(size_t pos) {
+        return queue_[Index(pos)];
+    }
+
+    const Element& Slot(size_t pos) const {
+        return queue_[Index(pos)];
+    }
+
     const size_t max_size_;
     const size_t bit_mask_;
+    const int index_bits_;
+    const int index_shift_;
     alignas(64) std::atomic_size_t head_ = 0;
     alignas(64) std::atomic_size_t tail_ = 0;
-    alignas(64) std::vector<Element> queue_;
+    alignas(64) std::atomic_int producers_waiting_ = 0;
+    std::atomic_int consumers_waiting_ = 0;
+    alignas(64) std::vector<Element, CacheLineAllocator<Element>> queue_;
+};
+
+template <class T, SlotLayout kLayout>
+class MPMCBoundedQueue<T, kLayout, Concurrency::kSingle> : public SPSCBoundedQueue<T> {
+public:
+    using SPSCBoundedQueue<T>::SPSCBoundedQueue;
 };
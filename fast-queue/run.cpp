@@ -1,4 +1,6 @@
+#include "../hazard-ptr/hazard_ptr.h"
 #include "mpmc.h"
+#include "unbounded_mpmc.h"
 #include "runner.h"
 
 #include <atomic>
@@ -25,8 +27,9 @@ void StressEnqueue(uint32_t num_producers) {
     CHECK(runner.Wait() < 10ns);
 }
 
-void StressEnqueueDequeue(uint32_t num_producers, uint32_t num_consumers) {
-    MPMCBoundedQueue<int> queue{64};
+template <class Queue = MPMCBoundedQueue<int>>
+void StressEnqueueDequeue(uint32_t num_producers, uint32_t num_consumers, size_t size = 64) {
+    Queue queue{size};
     TimeRunner prod_runner{1s};
     for (auto i = 0u; i < num_producers; ++i) {
         prod_runner.Do([&] { queue.Enqueue(0); });
@@ -35,11 +38,47 @@ void StressEnqueueDequeue(uint32_t num_producers, uint32_t num_consumers) {
     for (auto i = 0u; i < num_consumers; ++i) {
         cons_runner.Do([&](int x) { queue.Dequeue(x); }, 0);
     }
-    INFO(std::to_string(num_producers) + ' ' + std::to_string(num_consumers));
+    INFO(std::to_string(num_producers) + ' ' + std::to_string(num_consumers) + ' ' +
+         std::to_string(size));
     CHECK(prod_runner.Wait() < 100ns);
     CHECK(cons_runner.Wait() < 100ns);
 }
 
+void StressBatchEnqueueDequeue(uint32_t num_producers, uint32_t num_consumers) {
+    static constexpr auto kBatchSize = 16;
+    MPMCBoundedQueue<int> queue{64};
+    TimeRunner prod_runner{1s};
+    for (auto i = 0u; i < num_producers; ++i) {
+        prod_runner.Do([&, batch = std::vector<int>(kBatchSize)] { queue.EnqueueBatch(batch); });
+    }
+    TimeRunner cons_runner{1s};
+    for (auto i = 0u; i < num_consumers; ++i) {
+        cons_runner.Do([&, batch = std::vector<int>(kBatchSize)]() mutable {
+            queue.DequeueBatch(batch.begin(), batch.size());
+        });
+    }
+    INFO(std::to_string(num_producers) + ' ' + std::to_string(num_consumers));
+    CHECK(prod_runner.Wait() < kBatchSize * 100ns);
+    CHECK(cons_runner.Wait() < kBatchSize * 100ns);
+}
+
+// Every thread enqueues and then dequeues, so the queue stays short while segments keep
+// being linked and retired.
+void StressUnbounded(uint32_t num_threads) {
+    MPMCUnboundedQueue<int> queue;
+    TimeRunner runner{1s};
+    for (auto i = 0u; i < num_threads; ++i) {
+        auto func = [&, value = 0]() mutable {
+            queue.Enqueue(value);
+            queue.Dequeue(value);
+        };
+        TaskWithExit task{std::move(func), UnregisterThread};
+        runner.DoWithInit(RegisterThread, std::move(task));
+    }
+    INFO(std::to_string(num_threads));
+    CHECK(runner.Wait() < 400ns);
+}
+
 void CorrectnessEnqueueDequeue(uint32_t num_producers, uint32_t num_consumers) {
     std::vector<std::atomic<int>> enqueued(num_producers);
     std::vector<std::atomic<int>> dequeued(num_producers);
@@ -90,6 +129,37 @@ TEST_CASE("Stress Enqueue Dequeue") {
     }
 }
 
+// 64K slots are 8MB padded and 1MB compact.
+TEST_CASE("Stress Enqueue Dequeue padded") {
+    for (size_t size : {64, 64 * 1024}) {
+        StressEnqueueDequeue<MPMCBoundedQueue<int>>(2, 2, size);
+    }
+}
+
+TEST_CASE("Stress Enqueue Dequeue compact") {
+    for (size_t size : {64, 64 * 1024}) {
+        StressEnqueueDequeue<MPMCBoundedQueue<int, SlotLayout::kCompact>>(2, 2, size);
+    }
+}
+
+TEST_CASE("Stress SPSC") {
+    using Queue = MPMCBoundedQueue<int, SlotLayout::kPadded, Concurrency::kSingle>;
+    StressEnqueueDequeue<Queue>(1, 1);
+    StressEnqueueDequeue<Queue>(1, 1, 64 * 1024);
+}
+
+TEST_CASE("Stress Batch Enqueue Dequeue") {
+    for (auto num_threads : {1, 2, 4}) {
+        StressBatchEnqueueDequeue(num_threads, num_threads);
+    }
+}
+
+TEST_CASE("Stress Unbounded") {
+    for (auto num_threads : {1, 2, 4, 8}) {
+        StressUnbounded(num_threads);
+    }
+}
+
 TEST_CASE("Correctness Enqueue Dequeue") {
     for (auto num_threads : {1, 2, 4}) {
         CorrectnessEnqueueDequeue(num_threads, num_threads);
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+// Bounded queue for exactly one producer and one consumer thread, used through
+// MPMCBoundedQueue<T, kLayout, Concurrency::kSingle>. Each side owns its index and keeps a cached
+// copy of the other one, which it reloads only when the queue looks full or empty. No CAS and no
+// per-slot state.
+template <class T>
+class SPSCBoundedQueue {
+public:
+    explicit SPSCBoundedQueue(size_t size) : bit_mask_(size - 1), queue_(size) {
+        if (!std::has_single_bit(size)) {
+            throw std::invalid_argument{"SPSCBoundedQueue size must be a power of two"};
+        }
+    }
+
+    bool Enqueue(const T& value) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - cached_head_ > bit_mask_) {
+            cached_head_ = head_.load(std::memory_order_acquire);
+            if (tail - cached_head_ > bit_mask_) {
+                return false;
+            }
+        }
+        queue_[tail & bit_mask_] = value;
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Dequeue(T& data) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cached_tail_) {
+            cached_tail_ = tail_.load(std::memory_order_acquire);
+            if (head == cached_tail_) {
+                return false;
+            }
+        }
+        data = std::move(queue_[head & bit_mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    const size_t bit_mask_;
+    std::vector<T> queue_;
+    alignas(64) std::atomic_size_t head_ = 0;
+    size_t cached_tail_ = 0;
+    alignas(64) std::atomic_size_t tail_ = 0;
+    size_t cached_head_ = 0;
+};
@@ -1,4 +1,5 @@
 #include "mpmc.h"
+#include "unbounded_mpmc.h"
 
 #include <thread>
 #include <vector>
@@ -6,6 +7,10 @@
 #include <ranges>
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <iterator>
+#include <span>
+#include <stdexcept>
 
 #include <catch2/catch_test_macros.hpp>
 
@@ -110,3 +115,302 @@ TEST_CASE("NoQueueLock") {
     REQUIRE(queue.Dequeue(k));
     REQUIRE(k == 0);
 }
+
+TEST_CASE("Batches") {
+    MPMCBoundedQueue<int> queue{4};
+    const std::vector values = {1, 2, 3, 4, 5, 6};
+    REQUIRE(queue.EnqueueBatch(values) == 4);
+    REQUIRE(queue.EnqueueBatch(values) == 0);
+
+    std::vector<int> out;
+    REQUIRE(queue.DequeueBatch(std::back_inserter(out), 3) == 3);
+    REQUIRE(out == std::vector{1, 2, 3});
+    REQUIRE(queue.EnqueueBatch(std::span{values}.subspan(4)) == 2);
+    REQUIRE(queue.Enqueue(7));
+    REQUIRE_FALSE(queue.Enqueue(8));
+
+    out.clear();
+    REQUIRE(queue.DequeueBatch(std::back_inserter(out), 10) == 4);
+    REQUIRE(out == std::vector{4, 5, 6, 7});
+    REQUIRE(queue.DequeueBatch(std::back_inserter(out), 10) == 0);
+}
+
+TEST_CASE("ConcurrentBatches") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kBatchSize = 16;
+    static constexpr auto kN = 64 * 1024;
+    MPMCBoundedQueue<int> queue{64};
+    std::array<std::atomic<int>, kN> results{};
+    std::atomic produced = 0;
+
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&, i] {
+            std::vector<int> batch;
+            for (auto x = i; x < kN; x += kNumThreads) {
+                batch.push_back(x);
+                if (batch.size() < kBatchSize && x + kNumThreads < kN) {
+                    continue;
+                }
+                std::span<const int> rest = batch;
+                while (!rest.empty()) {
+                    if (auto count = queue.EnqueueBatch(rest)) {
+                        rest = rest.subspan(count);
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+                batch.clear();
+            }
+            ++produced;
+        });
+    }
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&] {
+            std::array<int, kBatchSize> batch;
+            while (true) {
+                auto done = produced == kNumThreads;
+                auto count = queue.DequeueBatch(batch.begin(), batch.size());
+                for (auto x : std::span{batch}.first(count)) {
+                    ++results[x];
+                }
+                if (count == 0) {
+                    if (done) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                }
+            }
+        });
+    }
+    threads.clear();
+
+    REQUIRE(std::ranges::all_of(results, [](const auto& a) { return a == 1; }));
+}
+
+TEST_CASE("BlockingPushPop") {
+    using namespace std::chrono_literals;
+    MPMCBoundedQueue<int> queue{2};
+    int val;
+    REQUIRE_FALSE(queue.Pop(val, 10ms));
+
+    std::jthread consumer{[&] {
+        auto x = 0;
+        queue.Pop(x);
+        CHECK(x == 1);
+        queue.Pop(x);
+        CHECK(x == 2);
+    }};
+    std::this_thread::sleep_for(50ms);
+    queue.Push(1);
+    queue.Push(2);
+    consumer.join();
+
+    REQUIRE(queue.Push(3, 10ms));
+    REQUIRE(queue.Push(4, 10ms));
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(queue.Push(5, 50ms));
+    REQUIRE(std::chrono::steady_clock::now() - start >= 50ms);
+
+    std::jthread producer{[&] { queue.Push(5); }};
+    std::this_thread::sleep_for(50ms);
+    REQUIRE(queue.Pop(val, 1s));
+    REQUIRE(val == 3);
+    producer.join();
+    REQUIRE(queue.Pop(val, 1s));
+    REQUIRE(val == 4);
+    REQUIRE(queue.Pop(val, 1s));
+    REQUIRE(val == 5);
+}
+
+TEST_CASE("BlockingNoLostWakeups") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kN = 32 * 1024;
+    MPMCBoundedQueue<int> queue{4};
+    std::array<std::atomic<int>, kN> results{};
+
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&, i] {
+            for (auto x = i; x < kN; x += kNumThreads) {
+                queue.Push(x);
+            }
+        });
+        threads.emplace_back([&] {
+            for (auto j = 0; j < kN / kNumThreads; ++j) {
+                auto x = 0;
+                queue.Pop(x);
+                ++results[x];
+            }
+        });
+    }
+    threads.clear();
+
+    REQUIRE(std::ranges::all_of(results, [](const auto& a) { return a == 1; }));
+}
+
+TEST_CASE("PowerOfTwoSize") {
+    REQUIRE_THROWS_AS(MPMCBoundedQueue<int>{3}, std::invalid_argument);
+    REQUIRE_NOTHROW(MPMCBoundedQueue<int>{4});
+}
+
+TEST_CASE("Close") {
+    MPMCBoundedQueue<int> queue{4};
+    REQUIRE(queue.Enqueue(1));
+    REQUIRE_FALSE(queue.IsDrained());
+    queue.Close();
+    REQUIRE_FALSE(queue.Enqueue(2));
+    REQUIRE_FALSE(queue.IsDrained());
+
+    auto val = 0;
+    REQUIRE(queue.Dequeue(val));
+    REQUIRE(val == 1);
+    REQUIRE(queue.IsDrained());
+    REQUIRE_FALSE(queue.Dequeue(val));
+    REQUIRE_FALSE(queue.Enqueue(3));
+}
+
+TEST_CASE("UnboundedOrder") {
+    RegisterThread();
+    {
+        MPMCUnboundedQueue<int, 4> queue;
+        for (auto x = 0; x < 100; ++x) {
+            queue.Enqueue(x);
+        }
+        auto val = 0;
+        for (auto x = 0; x < 100; ++x) {
+            REQUIRE(queue.Dequeue(val));
+            REQUIRE(val == x);
+        }
+        REQUIRE_FALSE(queue.Dequeue(val));
+
+        queue.Enqueue(100);
+        REQUIRE(queue.Dequeue(val));
+        REQUIRE(val == 100);
+        for (auto x = 0; x < 10; ++x) {
+            queue.Enqueue(x);
+        }
+    }
+    UnregisterThread();
+}
+
+TEST_CASE("UnboundedConcurrent") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kN = 64 * 1024;
+    std::array<std::atomic<int>, kN> results{};
+    std::atomic produced = 0;
+    MPMCUnboundedQueue<int, 16> queue;
+
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&, i] {
+            RegisterThread();
+            for (auto x = i; x < kN; x += kNumThreads) {
+                queue.Enqueue(x);
+            }
+            ++produced;
+            UnregisterThread();
+        });
+        threads.emplace_back([&] {
+            RegisterThread();
+            auto last_done = false;
+            while (!last_done) {
+                last_done = produced == kNumThreads;
+                auto x = 0;
+                while (queue.Dequeue(x)) {
+                    ++results[x];
+                }
+                std::this_thread::yield();
+            }
+            UnregisterThread();
+        });
+    }
+    threads.clear();
+
+    REQUIRE(std::ranges::all_of(results, [](const auto& a) { return a == 1; }));
+}
+
+TEST_CASE("CompactLayout") {
+    for (auto size : {2, 8, 64}) {
+        MPMCBoundedQueue<int, SlotLayout::kCompact> queue(size);
+        for (auto round = 0; round < 3; ++round) {
+            for (auto x = 0; x < size; ++x) {
+                REQUIRE(queue.Enqueue(x));
+            }
+            REQUIRE_FALSE(queue.Enqueue(size));
+            auto val = 0;
+            for (auto x = 0; x < size; ++x) {
+                REQUIRE(queue.Dequeue(val));
+                REQUIRE(val == x);
+            }
+            REQUIRE_FALSE(queue.Dequeue(val));
+        }
+    }
+}
+
+TEST_CASE("CompactLayoutConcurrent") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kN = 64 * 1024;
+    MPMCBoundedQueue<int, SlotLayout::kCompact> queue{64};
+    std::array<std::atomic<int>, kN> results{};
+
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&, i] {
+            for (auto x = i; x < kN; x += kNumThreads) {
+                queue.Push(x);
+            }
+        });
+        threads.emplace_back([&] {
+            for (auto j = 0; j < kN / kNumThreads; ++j) {
+                auto x = 0;
+                queue.Pop(x);
+                ++results[x];
+            }
+        });
+    }
+    threads.clear();
+
+    REQUIRE(std::ranges::all_of(results, [](const auto& a) { return a == 1; }));
+}
+
+TEST_CASE("SPSC") {
+    MPMCBoundedQueue<int, SlotLayout::kPadded, Concurrency::kSingle> queue{2};
+    auto val = 0;
+    REQUIRE_FALSE(queue.Dequeue(val));
+    REQUIRE(queue.Enqueue(1));
+    REQUIRE(queue.Enqueue(2));
+    REQUIRE_FALSE(queue.Enqueue(3));
+    REQUIRE(queue.Dequeue(val));
+    REQUIRE(val == 1);
+    REQUIRE(queue.Enqueue(3));
+    REQUIRE(queue.Dequeue(val));
+    REQUIRE(val == 2);
+    REQUIRE(queue.Dequeue(val));
+    REQUIRE(val == 3);
+    REQUIRE_FALSE(queue.Dequeue(val));
+}
+
+TEST_CASE("SPSCConcurrent") {
+    static constexpr auto kN = 1'000'000;
+    MPMCBoundedQueue<int, SlotLayout::kPadded, Concurrency::kSingle> queue{64};
+    std::jthread producer{[&] {
+        for (auto x = 0; x < kN;) {
+            if (queue.Enqueue(x)) {
+                ++x;
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }};
+
+    auto in_order = true;
+    for (auto expected = 0; expected < kN;) {
+        if (auto x = 0; queue.Dequeue(x)) {
+            in_order &= x == expected++;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    REQUIRE(in_order);
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "../hazard-ptr/hazard_ptr.h"
+#include "mpmc.h"
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+
+// Unbounded MPMC queue: a linked list of MPMCBoundedQueue segments. Producers fill the tail
+// segment, the first one that finds it full closes it and links a new segment holding its
+// element. Consumers drain the head segment and move past it once it is closed and empty,
+// the consumer that unlinks it retires it through the hazard pointers. Every thread that uses
+// the queue must call RegisterThread first.
+template <class T, size_t kSegmentSize = 256>
+class MPMCUnboundedQueue {
+public:
+    static_assert(std::has_single_bit(kSegmentSize));
+
+    MPMCUnboundedQueue() : head_(new Segment), tail_(head_.load()) {
+    }
+
+    MPMCUnboundedQueue(const MPMCUnboundedQueue&) = delete;
+    MPMCUnboundedQueue& operator=(const MPMCUnboundedQueue&) = delete;
+
+    ~MPMCUnboundedQueue() {
+        for (auto* segment = head_.load(); segment;) {
+            auto* next = segment->next.load();
+            delete segment;
+            segment = next;
+        }
+    }
+
+    void Enqueue(const T& value) {
+        // Allocated at most once per call: a segment that lost the race to be linked already
+        // holds our element and is kept for the next attempt.
+        Segment* fresh = nullptr;
+        while (true) {
+            auto* segment = Acquire(&tail_);
+            if (segment->ring.Enqueue(value)) {
+                break;
+            }
+            segment->ring.Close();
+
+            auto* next = segment->next.load();
+            if (!next) {
+                if (!fresh) {
+                    fresh = new Segment;
+                    fresh->ring.Enqueue(value);
+                }
+                if (segment->next.compare_exchange_strong(next, fresh)) {
+                    tail_.compare_exchange_strong(segment, fresh);
+                    fresh = nullptr;
+                    break;
+                }
+            }
+            tail_.compare_exchange_strong(segment, next);
+        }
+        Release();
+        delete fresh;
+    }
+
+    bool Dequeue(T& data) {
+        auto* segment = Acquire(&head_);
+        while (!segment->ring.Dequeue(data)) {
+            auto* next = segment->next.load();
+            if (!next || !segment->ring.IsDrained()) {
+                Release();
+                return false;
+            }
+
+            // tail_ may still point to the segment if its producer has not advanced it yet. Move
+            // it first, so that nobody can acquire the segment after it is retired.
+            auto* expected = segment;
+            tail_.compare_exchange_strong(expected, next);
+            expected = segment;
+            if (head_.compare_exchange_strong(expected, next)) {
+                Release();
+                Retire(segment);
+            }
+            segment = Acquire(&head_);
+        }
+        Release();
+        return true;
+    }
+
+private:
+    struct Segment {
+        MPMCBoundedQueue<T> ring{kSegmentSize};
+        std::atomic<Segment*> next = nullptr;
+    };
+
+    alignas(64) std::atomic<Segment*> head_;
+    alignas(64) std::atomic<Segment*> tail_;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <list>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Separate chaining: every bucket is a list of entries, newest first. Keys are only compared
+// with Equal, so K needs no ordering.
+// Not thread-safe, ConcurrentHashMap guards every table with its stripe mutex.
+template <class K, class V, class Equal, class Allocator = std::allocator<std::pair<K, V>>>
+class ChainedTable {
+public:
+    using Entry = std::pair<K, V>;
+
+    // Erase frees list nodes right away, a reader without the mutex could follow a dangling one.
+    static constexpr bool kLockFreeReads = false;
+
+    explicit ChainedTable(size_t expected_size, const Equal& equal = {})
+        : table_(std::max<size_t>(1, (expected_size + kMaxLoadFactor - 1) / kMaxLoadFactor)),
+          equal_(equal) {
+    }
+
+    template <class Key>
+    const Entry* Find(size_t hash, const Key& key) const {
+        const auto& list = table_[hash % table_.size()];
+        auto f_iter = FindInList(list, key);
+        return f_iter != list.end() ? &*f_iter : nullptr;
+    }
+
+    template <class Key>
+    Entry* Find(size_t hash, const Key& key) {
+        return const_cast<Entry*>(std::as_const(*this).Find(hash, key));
+    }
+
+    // Only the list header is known without a dependent load, the nodes are not prefetched.
+    void Prefetch(size_t hash) const {
+        __builtin_prefetch(&table_[hash % table_.size()]);
+    }
+
+    // Builds the value from args only if the key is missing. Returns the entry with the key and
+    // whether it was inserted.
+    template <class... Args>
+    std::pair<Entry*, bool> Emplace(size_t hash, const K& key, Args&&... args) {
+        auto& list = table_[hash % table_.size()];
+        auto f_iter = FindInList(list, key);
+        if (f_iter != list.end()) {
+            return {&*f_iter, false};
+        }
+        auto& elem = list.emplace_front(std::piecewise_construct, std::forward_as_tuple(key),
+                                        std::forward_as_tuple(std::forward<Args>(args)...));
+        ++size_;
+        return {&elem, true};
+    }
+
+    template <class Key>
+    bool Erase(size_t hash, const Key& key) {
+        auto& list = table_[hash % table_.size()];
+        auto f_iter = FindInList(list, key);
+        if (f_iter != list.end()) {
+            list.erase(f_iter);
+            --size_;
+            return true;
+        } else {
+            return false;
+        }
+    }
+
+    void Clear() {
+        for (auto& list : table_) {
+            list.clear();
+        }
+        size_ = 0;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    size_t BucketCount() const {
+        return table_.size();
+    }
+
+    bool Overloaded() const {
+        return size_ > kMaxLoadFactor * table_.size();
+    }
+
+    size_t NextBucketCount() const {
+        return table_.size() * 2;
+    }
+
+    static ChainedTable WithBucketCount(size_t bucket_count, const Equal& equal = {}) {
+        return ChainedTable(bucket_count * kMaxLoadFactor, equal);
+    }
+
+    template <class F>
+    void ForEach(F& fn) const {
+        for (const auto& list : table_) {
+            for (const auto& [key, value] : list) {
+                fn(key, value);
+            }
+        }
+    }
+
+    // Relinks every node of the bucket into the table `to`, no element is copied.
+    template <class LocalHash>
+    void MigrateBucket(size_t list_idx, ChainedTable& to, const LocalHash& hash) {
+        auto& list = table_[list_idx];
+        size_ -= list.size();
+        to.size_ += list.size();
+        while (!list.empty()) {
+            auto& new_list = to.table_[hash(list.front().first) % to.table_.size()];
+            new_list.splice(new_list.begin(), list, list.begin());
+        }
+    }
+
+private:
+    template <class List, class Key>
+    auto FindInList(List& list, const Key& key) const {
+        return std::find_if(list.begin(), list.end(),
+                            [&](const Entry& elem) { return equal_(elem.first, key); });
+    }
+
+    static constexpr size_t kMaxLoadFactor = 2;
+
+    std::vector<std::list<Entry, Allocator>> table_;
+    size_t size_ = 0;
+    [[no_unique_address]] Equal equal_;
+};
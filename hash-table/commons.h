@@ -59,7 +59,7 @@ private:
     std::uniform_int_distribution<int> dist_;
 };
 
-template <bool check_insertions = false>
+template <bool check_insertions = false, class Map = ConcurrentHashMap<int, int>>
 class Tester {
 public:
     explicit Tester(uint32_t num_iterations = kMaxIterations) : num_iterations_{num_iterations} {
@@ -116,7 +116,7 @@ public:
 
 private:
     const uint32_t num_iterations_;
-    ConcurrentHashMap<int, int> table_;
+    Map table_;
     std::forward_list<std::vector<int>> loggers_;
     std::vector<std::jthread> threads_;
 };
@@ -1,114 +1,395 @@
 #pragma once
 
+#include "chained_table.h"
+#include "flat_table.h"
+#include "node_pool.h"
+
+#include <algorithm>
+#include <bit>
 #include <cstddef>
+#include <memory>
 #include <mutex>
+#include <numeric>
+#include <ranges>
+#include <span>
 #include <stdexcept>
+#include <thread>
 #include <vector>
-#include <list>
 #include <atomic>
+#include <functional>
+
+// Storage policies: how a single stripe keeps its entries.
+template <template <class> class Allocator>
+struct BasicChainedStorage {
+    template <class K, class V, class Equal>
+    using Table = ChainedTable<K, V, Equal, Allocator<std::pair<K, V>>>;
+};
 
-template <class K, class V, class Hash = std::hash<K>>
+// List nodes come from per-thread pools, so insert/erase churn rarely reaches operator new.
+using ChainedStorage = BasicChainedStorage<PoolAllocator>;
+
+struct FlatStorage {
+    template <class K, class V, class Equal>
+    using Table = FlatTable<K, V, Equal>;
+};
+
+// When both Hash and Equal define is_transparent, Find, At, Update and Erase accept any key type
+// they can hash and compare, e.g. std::string_view for std::string keys, without building a K.
+template <class K, class V, class Hash = std::hash<K>, class Storage = ChainedStorage,
+          class Equal = std::equal_to<K>>
 class ConcurrentHashMap {
+    using Table = typename Storage::template Table<K, V, Equal>;
+
+    static constexpr bool kTransparentLookup = requires {
+        typename Hash::is_transparent;
+        typename Equal::is_transparent;
+    };
+
 public:
-    explicit ConcurrentHashMap(const Hash& hasher = {})
-        : ConcurrentHashMap{kUndefinedSize, hasher} {
+    explicit ConcurrentHashMap(const Hash& hasher = {}, const Equal& equal = {})
+        : ConcurrentHashMap{kUndefinedSize, hasher, equal} {
     }
 
-    explicit ConcurrentHashMap(int expected_size, const Hash& hasher = {})
-        : ConcurrentHashMap{expected_size, kDefaultConcurrencyLevel, hasher} {
+    explicit ConcurrentHashMap(int expected_size, const Hash& hasher = {},
+                               const Equal& equal = {})
+        : ConcurrentHashMap{expected_size, kDefaultConcurrencyLevel, hasher, equal} {
     }
 
-    ConcurrentHashMap(int expected_size, int expected_threads_count, const Hash& hasher = {})
-        : table_(), hasher_(hasher) {
-        if (expected_size != kUndefinedSize) {
-            const size_t lists_cnt =
-                ((((expected_size - 1) / kLoadFactor + 1) - 1) / expected_threads_count + 1) *
-                expected_threads_count;
-            table_ =
-                std::vector<std::list<std::pair<K, V>>>(lists_cnt, std::list<std::pair<K, V>>{});
-        } else {
-            table_ = std::vector<std::list<std::pair<K, V>>>(4 * expected_threads_count,
-                                                             std::list<std::pair<K, V>>{});
+    ConcurrentHashMap(int expected_size, int expected_threads_count, const Hash& hasher = {},
+                      const Equal& equal = {})
+        : segments_(std::bit_ceil<size_t>(kStripesPerThread * expected_threads_count)),
+          hasher_(hasher),
+          equal_(equal),
+          stripe_shift_(std::countr_zero(segments_.size())) {
+        // Zero and kUndefinedSize give no hint, so stripes start at the default size.
+        const size_t stripe_size =
+            expected_size > 0 ? (static_cast<size_t>(expected_size) - 1) / segments_.size() + 1
+                              : kDefaultStripeSize;
+        for (auto& segment : segments_) {
+            auto& table =
+                segment.tables.emplace_back(std::make_unique<Table>(stripe_size, equal_));
+            segment.table = table.get();
         }
+    }
 
-        mutexes_ = std::vector<std::mutex>(table_.size());
+    bool Insert(const K& key, const V& value) {
+        return TryEmplace(key, value);
+    }
 
-        is_rehashing_.clear();
+    // Builds the value from args only if the key is missing, returns true on insertion.
+    template <class... Args>
+    bool TryEmplace(const K& key, Args&&... args) {
+        return WithStripe(key, [&](Segment& segment, size_t local_hash) {
+            return EmplaceLocked(segment, local_hash, key, std::forward<Args>(args)...).second;
+        });
     }
 
-    bool Insert(const K& key, const V& value) {
-        const auto hash = hasher_(key);
-        const auto mutex_idx = hash % mutexes_.size();
-        bool res;
-        bool need_rehash = false;
-        {
-            std::lock_guard lock(mutexes_[mutex_idx]);
-            const auto list_idx = hash % table_.size();
-
-            if ((res = InsertIntoList(list_idx, std::pair<K, V>(key, value)))) {
-                ++size_;
+    // Overwrites the stored value if there is one, returns true on insertion.
+    template <class M>
+    bool InsertOrAssign(const K& key, M&& value) {
+        return WithStripe(key, [&](Segment& segment, size_t local_hash) {
+            // The emplace consumes value only when it inserts.
+            auto [elem, inserted] = EmplaceLocked(segment, local_hash, key, std::forward<M>(value));
+            if (!inserted) {
+                elem->second = std::forward<M>(value);
+            }
+            return inserted;
+        });
+    }
+
+    // Calls fn(value) on the stored value under the stripe lock, returns false if the key is
+    // missing. fn must not call back into the map.
+    template <class F>
+    bool Update(const K& key, F&& fn) {
+        return UpdateImpl(key, fn);
+    }
+
+    template <class Key, class F>
+        requires kTransparentLookup
+    bool Update(const Key& key, F&& fn) {
+        return UpdateImpl(key, fn);
+    }
+
+    // Inserts init if the key is missing and calls fn(value) on the stored value otherwise,
+    // returns true on insertion.
+    template <class F>
+    bool Upsert(const K& key, const V& init, F&& fn) {
+        return WithStripe(key, [&](Segment& segment, size_t local_hash) {
+            auto [elem, inserted] = EmplaceLocked(segment, local_hash, key, init);
+            if (!inserted) {
+                fn(elem->second);
             }
+            return inserted;
+        });
+    }
 
-            if (size_ / table_.size() > kLoadFactor) {
-                need_rehash = true;
+    bool Erase(const K& key) {
+        return EraseImpl(key);
+    }
+
+    template <class Key>
+        requires kTransparentLookup
+    bool Erase(const Key& key) {
+        return EraseImpl(key);
+    }
+
+    void Clear() {
+        LockAll();
+        for (auto& segment : segments_) {
+            VersionGuard guard(segment);
+            segment.table.load()->Clear();
+            if (auto* old_table = segment.old_table.exchange(nullptr)) {
+                RetireTable(segment, old_table);
             }
+            segment.size.store(0, std::memory_order_relaxed);
         }
+        UnlockAll();
+    }
+
+    std::pair<bool, V> Find(const K& key) const {
+        return FindImpl(key);
+    }
+
+    template <class Key>
+        requires kTransparentLookup
+    std::pair<bool, V> Find(const Key& key) const {
+        return FindImpl(key);
+    }
 
-        if (need_rehash && !is_rehashing_.test_and_set()) {
-            Rehash();
-            is_rehashing_.clear();
+    V At(const K& key) const {
+        return AtImpl(key);
+    }
+
+    template <class Key>
+        requires kTransparentLookup
+    V At(const Key& key) const {
+        return AtImpl(key);
+    }
+
+    // Batched operations hash all keys up front and visit every touched stripe once, under a
+    // single lock acquisition. The buckets of a stripe are prefetched before they are probed.
+    // Keys of one stripe are processed in batch order and each one moves a migration step, so
+    // a batch behaves exactly as a sequence of single calls would. Insert and Erase return the
+    // number of successful ones.
+    size_t InsertBatch(std::span<const std::pair<K, V>> entries) {
+        const auto hashes =
+            HashAll(entries, [](const auto& entry) -> const K& { return entry.first; });
+        size_t inserted = 0;
+        ForEachStripe(hashes, [&](size_t stripe_idx, std::span<const size_t> indices) {
+            std::lock_guard lock(segments_[stripe_idx].mutex);
+            auto& segment = segments_[stripe_idx];
+            VersionGuard guard(segment);
+            Prefetch(segment, hashes, indices);
+            for (auto i : indices) {
+                MigrateStep(segment);
+                const auto& [key, value] = entries[i];
+                inserted += EmplaceLocked(segment, LocalHash(hashes[i]), key, value).second;
+            }
+        });
+        return inserted;
+    }
+
+    size_t EraseBatch(std::span<const K> keys) {
+        const auto hashes = HashAll(keys, [](const K& key) -> const K& { return key; });
+        size_t erased = 0;
+        ForEachStripe(hashes, [&](size_t stripe_idx, std::span<const size_t> indices) {
+            std::lock_guard lock(segments_[stripe_idx].mutex);
+            auto& segment = segments_[stripe_idx];
+            VersionGuard guard(segment);
+            Prefetch(segment, hashes, indices);
+            for (auto i : indices) {
+                MigrateStep(segment);
+                erased += EraseLocked(segment, LocalHash(hashes[i]), keys[i]);
+            }
+        });
+        return erased;
+    }
+
+    std::vector<std::pair<bool, V>> FindBatch(std::span<const K> keys) const {
+        const auto hashes = HashAll(keys, [](const K& key) -> const K& { return key; });
+        std::vector<std::pair<bool, V>> result(keys.size());
+        ForEachStripe(hashes, [&](size_t stripe_idx, std::span<const size_t> indices) {
+            auto& segment = segments_[stripe_idx];
+            std::vector<size_t> retries;
+            if constexpr (kLockFreeReads) {
+                Prefetch(segment, hashes, indices);
+                for (auto i : indices) {
+                    if (!TryOptimisticFind(segment, LocalHash(hashes[i]), keys[i], &result[i])) {
+                        retries.push_back(i);
+                    }
+                }
+                if (retries.empty()) {
+                    return;
+                }
+                indices = retries;
+            }
+
+            std::lock_guard lock(segments_[stripe_idx].mutex);
+            VersionGuard guard(segment);
+            if constexpr (!kLockFreeReads) {
+                Prefetch(segment, hashes, indices);
+            }
+            for (auto i : indices) {
+                MigrateStep(segment);
+                result[i] = FindLocked(segment, LocalHash(hashes[i]), keys[i]);
+            }
+        });
+        return result;
+    }
+
+    // Iteration is weakly consistent: stripes are visited one at a time under their own lock, so
+    // each stripe is seen in a consistent state while writers keep working on the others. An
+    // entry that is neither inserted nor erased during the walk is visited exactly once.
+    // fn(key, value) runs under a stripe lock and must not call back into the map.
+    template <class F>
+    void ForEach(F&& fn) const {
+        for (size_t i = 0; i < segments_.size(); ++i) {
+            VisitStripe(i, fn);
         }
+    }
 
-        return res;
+    // Same as ForEach, but num_threads workers share the stripes, so fn must be thread-safe.
+    template <class F>
+    void ForEachParallel(F&& fn, int num_threads) const {
+        std::atomic_size_t next_stripe = 0;
+        std::vector<std::jthread> workers;
+        for (auto i = 0; i < num_threads; ++i) {
+            workers.emplace_back([this, &fn, &next_stripe] {
+                for (auto stripe_idx = next_stripe++; stripe_idx < segments_.size();
+                     stripe_idx = next_stripe++) {
+                    VisitStripe(stripe_idx, fn);
+                }
+            });
+        }
     }
 
-    bool Erase(const K& key) {
-        const auto hash = hasher_(key);
-        const auto mutex_idx = hash % mutexes_.size();
-        std::lock_guard lock(mutexes_[mutex_idx]);
-        const auto list_idx = hash % table_.size();
+    // Copies all entries out with ForEach, so it never stops more than one stripe at a time.
+    std::vector<std::pair<K, V>> Snapshot() const {
+        std::vector<std::pair<K, V>> entries;
+        entries.reserve(Size());
+        ForEach([&entries](const K& key, const V& value) { entries.emplace_back(key, value); });
+        return entries;
+    }
 
-        if (EraseFromList(list_idx, key)) {
-            --size_;
-            return true;
-        } else {
-            return false;
+    // Sums the per-stripe counters without locking. Exact while no writer runs, otherwise it
+    // may miss or count operations that are in flight.
+    size_t Size() const {
+        size_t size = 0;
+        for (const auto& segment : segments_) {
+            size += segment.size.load(std::memory_order_relaxed);
         }
+        return size;
     }
 
-    void Clear() {
-        for (int i = 0; i < std::ssize(mutexes_); ++i) {
-            mutexes_[i].lock();
+    // Takes every stripe lock, so the result is the size at one moment.
+    size_t ExactSize() const {
+        LockAll();
+        auto size = Size();
+        UnlockAll();
+        return size;
+    }
+
+    static constexpr auto kUndefinedSize = -1;
+
+private:
+    // A stripe grows incrementally: the overloaded table becomes old_table and every operation
+    // on the stripe moves a few of its buckets into the new one, so no caller pays for the whole
+    // migration. An entry is always in exactly one of the two tables.
+    //
+    // With lock-free reads the segment is also a seqlock: writers keep version odd while they
+    // change it, readers probe without the mutex and retry if version moved meanwhile. A reader
+    // may still be probing a retired table, so such tables are kept for reuse instead of being
+    // freed. Capacities only grow, so they take at most a few times the largest table.
+    //
+    // Every stripe has its own mutex and entry count, and segments never share a cache line, so
+    // writers to different stripes touch no common memory. size changes only under mutex.
+    struct alignas(64) Segment {
+        std::mutex mutex;
+        std::atomic<Table*> table = nullptr;
+        std::atomic<Table*> old_table = nullptr;
+        size_t migrated_buckets = 0;
+        std::atomic_size_t version = 0;
+        std::atomic_size_t size = 0;
+        std::vector<std::unique_ptr<Table>> tables;
+    };
+
+    class VersionGuard {
+    public:
+        explicit VersionGuard(Segment& segment) : segment_(segment) {
+            if constexpr (kLockFreeReads) {
+                segment_.version.store(segment_.version.load(std::memory_order_relaxed) + 1,
+                                       std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+            }
         }
 
-        for (size_t i = 0; i < table_.size(); ++i) {
-            table_[i].clear();
+        ~VersionGuard() {
+            if constexpr (kLockFreeReads) {
+                segment_.version.store(segment_.version.load(std::memory_order_relaxed) + 1,
+                                       std::memory_order_release);
+            }
         }
 
-        size_ = 0;
+        VersionGuard(const VersionGuard&) = delete;
+        VersionGuard& operator=(const VersionGuard&) = delete;
 
-        for (int i = std::ssize(mutexes_) - 1; i >= 0; --i) {
-            mutexes_[i].unlock();
+    private:
+        Segment& segment_;
+    };
+
+    template <class Key>
+    bool TryOptimisticFind(const Segment& segment, size_t local_hash, const Key& key,
+                           std::pair<bool, V>* result) const {
+        const auto version = segment.version.load(std::memory_order_acquire);
+        if (version % 2) {
+            return false;
+        }
+        auto status = segment.table.load(std::memory_order_acquire)
+                          ->RacyFind(local_hash, key, &result->second);
+        if (status == RacyFindStatus::kMissing) {
+            if (const auto* old_table = segment.old_table.load(std::memory_order_acquire)) {
+                status = old_table->RacyFind(local_hash, key, &result->second);
+            }
         }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (status == RacyFindStatus::kInconsistent ||
+            segment.version.load(std::memory_order_relaxed) != version) {
+            return false;
+        }
+        result->first = status == RacyFindStatus::kFound;
+        if (!result->first) {
+            result->second = {};
+        }
+        return true;
     }
 
-    std::pair<bool, V> Find(const K& key) const {
+    using Entry = typename Table::Entry;
+
+    template <class Key>
+    std::pair<bool, V> FindImpl(const Key& key) const {
         const auto hash = hasher_(key);
-        const auto mutex_idx = hash % mutexes_.size();
-        std::lock_guard lock(mutexes_[mutex_idx]);
-        const auto list_idx = hash % table_.size();
-
-        auto f_iter = FindPosInList(list_idx, key);
-        const auto& list = table_[list_idx];
-        if (f_iter != list.end() && f_iter->first == key) {
-            return {true, f_iter->second};
-        } else {
-            return {false, {}};
+        const auto stripe_idx = StripeIndex(hash);
+        const auto local_hash = LocalHash(hash);
+        auto& segment = segments_[stripe_idx];
+
+        if constexpr (kLockFreeReads) {
+            std::pair<bool, V> result;
+            for (auto attempt = 0; attempt < kOptimisticAttempts; ++attempt) {
+                if (TryOptimisticFind(segment, local_hash, key, &result)) {
+                    return result;
+                }
+            }
         }
+
+        std::lock_guard lock(segments_[stripe_idx].mutex);
+        VersionGuard guard(segment);
+        MigrateStep(segment);
+        return FindLocked(segment, local_hash, key);
     }
 
-    V At(const K& key) const {
-        auto elem = Find(key);
+    template <class Key>
+    V AtImpl(const Key& key) const {
+        auto elem = FindImpl(key);
         if (elem.first) {
             return elem.second;
         } else {
@@ -116,98 +397,222 @@ public:
         }
     }
 
-    size_t Size() const {
-        return size_;
+    template <class Key, class F>
+    bool UpdateImpl(const Key& key, F& fn) {
+        return WithStripe(key, [&](Segment& segment, size_t local_hash) {
+            auto* elem = FindEntry(segment, local_hash, key);
+            if (elem) {
+                fn(elem->second);
+            }
+            return elem != nullptr;
+        });
     }
 
-    static constexpr auto kUndefinedSize = -1;
+    template <class Key>
+    bool EraseImpl(const Key& key) {
+        return WithStripe(key, [&](Segment& segment, size_t local_hash) {
+            return EraseLocked(segment, local_hash, key);
+        });
+    }
 
-private:
-    std::list<std::pair<K, V>>::const_iterator FindPosInList(size_t list_idx, const K& key) const {
-        const auto& list = table_[list_idx];
-        for (auto it = list.begin(); it != list.end(); ++it) {
-            if (it->first >= key) {
-                return it;
+    // Takes the stripe lock of key and runs fn(segment, local_hash) as one write operation.
+    template <class Key, class F>
+    decltype(auto) WithStripe(const Key& key, F&& fn) {
+        const auto hash = hasher_(key);
+        const auto stripe_idx = StripeIndex(hash);
+        std::lock_guard lock(segments_[stripe_idx].mutex);
+        auto& segment = segments_[stripe_idx];
+        VersionGuard guard(segment);
+        MigrateStep(segment);
+        return fn(segment, LocalHash(hash));
+    }
+
+    // The returned entry stays valid until the next migration step on the stripe.
+    template <class... Args>
+    std::pair<Entry*, bool> EmplaceLocked(Segment& segment, size_t local_hash, const K& key,
+                                          Args&&... args) {
+        if (segment.old_table) {
+            if (auto* elem = segment.old_table.load()->Find(local_hash, key)) {
+                return {elem, false};
             }
         }
+        auto& table = *segment.table.load();
+        auto [elem, inserted] = table.Emplace(local_hash, key, std::forward<Args>(args)...);
+        if (!inserted) {
+            return {elem, false};
+        }
+        segment.size.store(segment.size.load(std::memory_order_relaxed) + 1,
+                           std::memory_order_relaxed);
 
-        return list.end();
+        if (table.Overloaded()) {
+            StartMigration(segment);
+        }
+        return {elem, true};
     }
 
-    std::list<std::pair<K, V>>::iterator FindPosInList(size_t list_idx, const K& key) {
-        auto& list = table_[list_idx];
-        for (auto it = list.begin(); it != list.end(); ++it) {
-            if (it->first >= key) {
-                return it;
-            }
+    template <class Key>
+    Entry* FindEntry(Segment& segment, size_t local_hash, const Key& key) {
+        auto* elem = segment.table.load()->Find(local_hash, key);
+        if (!elem && segment.old_table) {
+            elem = segment.old_table.load()->Find(local_hash, key);
         }
-
-        return list.end();
+        return elem;
     }
 
-    bool InsertIntoList(size_t list_idx, std::pair<K, V>&& elem) {
-        auto& list = table_[list_idx];
-        auto f_iter = FindPosInList(list_idx, elem.first);
-        if (f_iter == list.end() || f_iter->first != elem.first) {
-            list.emplace(f_iter, std::move(elem));
+    template <class Key>
+    bool EraseLocked(Segment& segment, size_t local_hash, const Key& key) {
+        if (segment.table.load()->Erase(local_hash, key) ||
+            (segment.old_table && segment.old_table.load()->Erase(local_hash, key))) {
+            segment.size.store(segment.size.load(std::memory_order_relaxed) - 1,
+                               std::memory_order_relaxed);
             return true;
         } else {
             return false;
         }
     }
 
-    bool EraseFromList(size_t list_idx, const K& key) {
-        auto& list = table_[list_idx];
-        auto f_iter = FindPosInList(list_idx, key);
-        if (f_iter != list.end() && f_iter->first == key) {
-            list.erase(f_iter);
-            return true;
+    template <class Key>
+    std::pair<bool, V> FindLocked(const Segment& segment, size_t local_hash, const Key& key) const {
+        const auto* elem = segment.table.load()->Find(local_hash, key);
+        if (!elem && segment.old_table) {
+            elem = segment.old_table.load()->Find(local_hash, key);
+        }
+        if (elem) {
+            return {true, elem->second};
         } else {
-            return false;
+            return {false, {}};
         }
     }
 
-    void Rehash() {
-        for (int i = 0; i < std::ssize(mutexes_); ++i) {
-            mutexes_[i].lock();
+    template <class Item, class GetKey>
+    std::vector<size_t> HashAll(std::span<const Item> items, const GetKey& get_key) const {
+        std::vector<size_t> hashes;
+        hashes.reserve(items.size());
+        for (const auto& item : items) {
+            hashes.push_back(hasher_(get_key(item)));
         }
+        return hashes;
+    }
 
-        table_.resize(table_.size() * 2);
+    // Calls visit(stripe_idx, indices) once per touched stripe, indices keep the batch order.
+    template <class Visit>
+    void ForEachStripe(const std::vector<size_t>& hashes, const Visit& visit) const {
+        std::vector<size_t> order(hashes.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::ranges::stable_sort(order, {}, [&](size_t i) { return StripeIndex(hashes[i]); });
+        for (auto begin = order.begin(); begin != order.end();) {
+            const auto stripe_idx = StripeIndex(hashes[*begin]);
+            auto end = std::find_if(begin, order.end(), [&](size_t i) {
+                return StripeIndex(hashes[i]) != stripe_idx;
+            });
+            visit(stripe_idx, std::span<const size_t>(begin, end));
+            begin = end;
+        }
+    }
 
-        for (size_t list_idx = 0; list_idx < table_.size(); ++list_idx) {
-            auto& list = table_[list_idx];
-            for (auto it = list.begin(); it != list.end();) {
-                const auto hash = hasher_(it->first);
-                const auto new_list_idx = hash % table_.size();
-                if (new_list_idx != list_idx) {
-                    auto elem = std::move(*it);
-                    InsertIntoList(new_list_idx, std::move(elem));
-                    if (it == list.begin()) {
-                        list.erase(it);
-                        it = list.begin();
-                    } else {
-                        auto remove_it = it;
-                        --it;
-                        list.erase(remove_it);
-                        ++it;
-                    }
-                } else {
-                    ++it;
+    void Prefetch(const Segment& segment, const std::vector<size_t>& hashes,
+                  std::span<const size_t> indices) const {
+        const auto* table = segment.table.load(std::memory_order_acquire);
+        for (auto i : indices) {
+            table->Prefetch(LocalHash(hashes[i]));
+        }
+    }
+
+    void StartMigration(Segment& segment) const {
+        if (segment.old_table) {
+            // The new table filled up before the previous migration was over, drain it at once.
+            MigrateStep(segment, segment.old_table.load()->BucketCount());
+        }
+        auto* new_table = NewTable(segment, segment.table.load()->NextBucketCount());
+        segment.old_table.store(segment.table.load(), std::memory_order_release);
+        segment.table.store(new_table, std::memory_order_release);
+        segment.migrated_buckets = 0;
+    }
+
+    void MigrateStep(Segment& segment, size_t max_buckets = kMigrationStep) const {
+        auto* old_table = segment.old_table.load();
+        if (!old_table) {
+            return;
+        }
+        const auto hash = [this](const K& key) { return LocalHash(hasher_(key)); };
+        const auto end = std::min(old_table->BucketCount(), segment.migrated_buckets + max_buckets);
+        for (; segment.migrated_buckets < end; ++segment.migrated_buckets) {
+            old_table->MigrateBucket(segment.migrated_buckets, *segment.table.load(), hash);
+        }
+        if (segment.migrated_buckets == old_table->BucketCount()) {
+            segment.old_table = nullptr;
+            RetireTable(segment, old_table);
+        }
+    }
+
+    Table* NewTable(Segment& segment, size_t bucket_count) const {
+        if constexpr (kLockFreeReads) {
+            for (auto& table : segment.tables) {
+                if (table.get() != segment.table && table.get() != segment.old_table &&
+                    table->BucketCount() == bucket_count) {
+                    table->Clear();
+                    return table.get();
                 }
             }
         }
+        // Plain new lets the returned prvalue initialize the table in place, without a move.
+        std::unique_ptr<Table> table(new Table(Table::WithBucketCount(bucket_count, equal_)));
+        return segment.tables.emplace_back(std::move(table)).get();
+    }
+
+    void RetireTable(Segment& segment, Table* table) const {
+        if constexpr (!kLockFreeReads) {
+            std::erase_if(segment.tables,
+                          [table](const auto& owned) { return owned.get() == table; });
+        }
+    }
+
+    template <class F>
+    void VisitStripe(size_t stripe_idx, F& fn) const {
+        std::lock_guard lock(segments_[stripe_idx].mutex);
+        const auto& segment = segments_[stripe_idx];
+        segment.table.load()->ForEach(fn);
+        if (const auto* old_table = segment.old_table.load()) {
+            old_table->ForEach(fn);
+        }
+    }
+
+    void LockAll() const {
+        for (auto& segment : segments_) {
+            segment.mutex.lock();
+        }
+    }
 
-        for (int i = std::ssize(mutexes_) - 1; i >= 0; --i) {
-            mutexes_[i].unlock();
+    void UnlockAll() const {
+        for (auto& segment : segments_ | std::views::reverse) {
+            segment.mutex.unlock();
         }
     }
 
+    // Low bits of the hash pick the stripe, the rest addresses the stripe's own table.
+    size_t StripeIndex(size_t hash) const {
+        return hash & (segments_.size() - 1);
+    }
+
+    size_t LocalHash(size_t hash) const {
+        return hash >> stripe_shift_;
+    }
+
+#ifdef __SANITIZE_THREAD__
+    // GCC rejects atomic_thread_fence under thread sanitizer, such builds lock on every read.
+    static constexpr bool kLockFreeReads = false;
+#else
+    static constexpr bool kLockFreeReads = Table::kLockFreeReads;
+#endif
+
     static constexpr auto kDefaultConcurrencyLevel = 8;
-    static constexpr auto kLoadFactor = 2;
+    static constexpr auto kStripesPerThread = 16;
+    static constexpr auto kDefaultStripeSize = 8;
+    static constexpr size_t kMigrationStep = 8;
+    static constexpr auto kOptimisticAttempts = 4;
 
-    std::vector<std::list<std::pair<K, V>>> table_;
+    mutable std::vector<Segment> segments_;
     Hash hasher_;
-    mutable std::vector<std::mutex> mutexes_;
-    std::atomic_size_t size_;
-    std::atomic_flag is_rehashing_;
+    [[no_unique_address]] Equal equal_;
+    const int stripe_shift_;
 };
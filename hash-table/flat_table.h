@@ -0,0 +1,298 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+enum class RacyFindStatus { kFound, kMissing, kInconsistent };
+
+// Open addressing with linear probing. Entries live in one contiguous array of slots, a parallel
+// array of control bytes keeps 7 bits of the hash for every full slot, so a probe compares keys
+// only on a tag match, using Equal. Erased slots become tombstones until the next rehash.
+// Not thread-safe, ConcurrentHashMap guards every table with its stripe mutex. The only exception
+// is RacyFind, see below.
+template <class K, class V, class Equal>
+class FlatTable {
+public:
+    using Entry = std::pair<K, V>;
+
+    static constexpr bool kLockFreeReads =
+        std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>;
+
+    explicit FlatTable(size_t expected_size, const Equal& equal = {})
+        : FlatTable(BucketCountTag{}, CapacityFor(expected_size), equal) {
+    }
+
+    FlatTable(FlatTable&& other) noexcept
+        : capacity_(std::exchange(other.capacity_, 0)),
+          size_(std::exchange(other.size_, 0)),
+          deleted_(std::exchange(other.deleted_, 0)),
+          ctrl_(std::move(other.ctrl_)),
+          slots_(std::move(other.slots_)),
+          equal_(std::move(other.equal_)) {
+    }
+
+    FlatTable& operator=(FlatTable&& other) noexcept {
+        Destroy();
+        capacity_ = std::exchange(other.capacity_, 0);
+        size_ = std::exchange(other.size_, 0);
+        deleted_ = std::exchange(other.deleted_, 0);
+        ctrl_ = std::move(other.ctrl_);
+        slots_ = std::move(other.slots_);
+        equal_ = std::move(other.equal_);
+        return *this;
+    }
+
+    ~FlatTable() {
+        Destroy();
+    }
+
+    template <class Key>
+    const Entry* Find(size_t hash, const Key& key) const {
+        const auto tag = Tag(hash);
+        for (auto i = Home(hash);; i = (i + 1) & (capacity_ - 1)) {
+            if (ctrl_[i] == kEmpty) {
+                return nullptr;
+            }
+            if (ctrl_[i] == tag && equal_(slots_[i].entry.first, key)) {
+                return &slots_[i].entry;
+            }
+        }
+    }
+
+    template <class Key>
+    Entry* Find(size_t hash, const Key& key) {
+        return const_cast<Entry*>(std::as_const(*this).Find(hash, key));
+    }
+
+    // Lookup that may run concurrently with a writer. It copies the key and the value out of
+    // the slot byte by byte and trusts nothing it reads, the caller has to validate the result
+    // (ConcurrentHashMap uses the stripe's version for that). Comparing a torn copy of a key must
+    // be harmless, which holds for trivially copyable keys whose Equal follows no pointers.
+    // The capacity and the arrays of a table never change, so the probe stays in bounds.
+    template <class Key>
+    __attribute__((no_sanitize("thread"))) RacyFindStatus RacyFind(size_t hash, const Key& key,
+                                                                    V* value) const
+        requires kLockFreeReads
+    {
+        const auto tag = Tag(hash);
+        const auto* ctrl = ctrl_.get();
+        const auto* slots = slots_.get();
+        auto i = Home(hash);
+        for (size_t probes = 0; probes < capacity_; ++probes, i = (i + 1) & (capacity_ - 1)) {
+            const auto slot_ctrl = ctrl[i];
+            if (slot_ctrl == kEmpty) {
+                return RacyFindStatus::kMissing;
+            }
+            if (slot_ctrl == tag && equal_(RacyCopy(&slots[i].entry.first), key)) {
+                *value = RacyCopy(&slots[i].entry.second);
+                return RacyFindStatus::kFound;
+            }
+        }
+        return RacyFindStatus::kInconsistent;
+    }
+
+    // Pulls the control byte and the slot a probe for hash starts from into the cache.
+    void Prefetch(size_t hash) const {
+        const auto i = Home(hash);
+        __builtin_prefetch(&ctrl_[i]);
+        __builtin_prefetch(&slots_[i]);
+    }
+
+    // Builds the value from args only if the key is missing. Returns the entry with the key and
+    // whether it was inserted.
+    template <class... Args>
+    std::pair<Entry*, bool> Emplace(size_t hash, const K& key, Args&&... args) {
+        const auto tag = Tag(hash);
+        auto free_slot = capacity_;
+        auto i = Home(hash);
+        for (;; i = (i + 1) & (capacity_ - 1)) {
+            if (ctrl_[i] == kEmpty) {
+                break;
+            }
+            if (ctrl_[i] == kDeleted) {
+                free_slot = std::min(free_slot, i);
+            } else if (ctrl_[i] == tag && equal_(slots_[i].entry.first, key)) {
+                return {&slots_[i].entry, false};
+            }
+        }
+        if (free_slot == capacity_) {
+            free_slot = i;
+        } else {
+            --deleted_;
+        }
+        Place(free_slot, tag, std::piecewise_construct, std::forward_as_tuple(key),
+              std::forward_as_tuple(std::forward<Args>(args)...));
+        return {&slots_[free_slot].entry, true};
+    }
+
+    template <class Key>
+    bool Erase(size_t hash, const Key& key) {
+        const auto tag = Tag(hash);
+        for (auto i = Home(hash);; i = (i + 1) & (capacity_ - 1)) {
+            if (ctrl_[i] == kEmpty) {
+                return false;
+            }
+            if (ctrl_[i] == tag && equal_(slots_[i].entry.first, key)) {
+                std::destroy_at(&slots_[i].entry);
+                ctrl_[i] = kDeleted;
+                --size_;
+                ++deleted_;
+                return true;
+            }
+        }
+    }
+
+    void Clear() {
+        Destroy();
+        std::fill_n(ctrl_.get(), capacity_, kEmpty);
+        size_ = 0;
+        deleted_ = 0;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    size_t BucketCount() const {
+        return capacity_;
+    }
+
+    // Tombstones terminate no probe, so they count against the load just like live entries.
+    bool Overloaded() const {
+        return (size_ + deleted_) * kMaxLoadDen > capacity_ * kMaxLoadNum;
+    }
+
+    // When the table is mostly tombstones a rehash at the same capacity is enough.
+    size_t NextBucketCount() const {
+        return size_ * 2 * kMaxLoadDen > capacity_ * kMaxLoadNum ? capacity_ * 2 : capacity_;
+    }
+
+    static FlatTable WithBucketCount(size_t bucket_count, const Equal& equal = {}) {
+        return FlatTable(BucketCountTag{}, bucket_count, equal);
+    }
+
+    template <class F>
+    void ForEach(F& fn) const {
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (IsFull(i)) {
+                fn(slots_[i].entry.first, slots_[i].entry.second);
+            }
+        }
+    }
+
+    // Moves the entry out of the slot into the table `to` and leaves a tombstone behind,
+    // so probe sequences running through the slot stay intact.
+    template <class LocalHash>
+    void MigrateBucket(size_t i, FlatTable& to, const LocalHash& hash) {
+        if (!IsFull(i)) {
+            return;
+        }
+        auto& elem = slots_[i].entry;
+        const auto local_hash = hash(elem.first);
+        auto j = to.Home(local_hash);
+        while (to.IsFull(j)) {
+            j = (j + 1) & (to.capacity_ - 1);
+        }
+        if (to.ctrl_[j] == kDeleted) {
+            --to.deleted_;
+        }
+        to.Place(j, Tag(local_hash), std::move(elem));
+        std::destroy_at(&elem);
+        ctrl_[i] = kDeleted;
+        --size_;
+        ++deleted_;
+    }
+
+private:
+    struct BucketCountTag {};
+
+    FlatTable(BucketCountTag, size_t capacity, const Equal& equal)
+        : capacity_(capacity),
+          ctrl_(std::make_unique<uint8_t[]>(capacity_)),
+          slots_(std::make_unique<Slot[]>(capacity_)),
+          equal_(equal) {
+        std::fill_n(ctrl_.get(), capacity_, kEmpty);
+    }
+
+    union Slot {
+        Slot() {
+        }
+        ~Slot() {
+        }
+        Entry entry;
+    };
+
+    static constexpr uint8_t kEmpty = 0x80;
+    static constexpr uint8_t kDeleted = 0xFE;
+    static constexpr size_t kMinCapacity = 8;
+    static constexpr size_t kMaxLoadNum = 7;
+    static constexpr size_t kMaxLoadDen = 8;
+    static constexpr uint64_t kFibonacciMultiplier = 0x9E3779B97F4A7C15ull;
+
+    static size_t CapacityFor(size_t expected_size) {
+        return std::bit_ceil(
+            std::max(kMinCapacity, expected_size * kMaxLoadDen / kMaxLoadNum + 1));
+    }
+
+    // Fibonacci hashing spreads hashers like std::hash<int>, which is the identity.
+    static uint64_t Mix(size_t hash) {
+        return static_cast<uint64_t>(hash) * kFibonacciMultiplier;
+    }
+
+    size_t Home(size_t hash) const {
+        return Mix(hash) >> (64 - std::countr_zero(capacity_)) & (capacity_ - 1);
+    }
+
+    static uint8_t Tag(size_t hash) {
+        return Mix(hash) & 0x7F;
+    }
+
+    // Volatile reads keep the compiler from turning the copy into a memcpy call, which thread
+    // sanitizer would intercept.
+    template <class T>
+    __attribute__((no_sanitize("thread"))) static T RacyCopy(const T* src) {
+        std::array<unsigned char, sizeof(T)> bytes;
+        const auto* src_bytes = reinterpret_cast<const volatile unsigned char*>(src);
+        for (size_t i = 0; i < sizeof(T); ++i) {
+            bytes[i] = src_bytes[i];
+        }
+        return std::bit_cast<T>(bytes);
+    }
+
+    bool IsFull(size_t i) const {
+        return (ctrl_[i] & kEmpty) == 0;
+    }
+
+    template <class... Args>
+    void Place(size_t i, uint8_t tag, Args&&... args) {
+        std::construct_at(&slots_[i].entry, std::forward<Args>(args)...);
+        ctrl_[i] = tag;
+        ++size_;
+    }
+
+    void Destroy() {
+        if (size_ == 0) {
+            return;
+        }
+        for (size_t i = 0; i < capacity_; ++i) {
+            if (IsFull(i)) {
+                std::destroy_at(&slots_[i].entry);
+            }
+        }
+    }
+
+    size_t capacity_;
+    size_t size_ = 0;
+    size_t deleted_ = 0;
+    std::unique_ptr<uint8_t[]> ctrl_;
+    std::unique_ptr<Slot[]> slots_;
+    [[no_unique_address]] Equal equal_;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Fixed-size blocks for one block size. Every thread keeps its own free list, so allocation and
+// deallocation touch no shared memory in the common case. Free blocks move between threads in
+// chains of kBatch through a shared list: a thread that frees more than it allocates gives
+// chains away, a thread that runs dry takes one before it carves a new slab.
+// Slabs are never returned to the system, the pool only recycles them.
+template <size_t kSize, size_t kAlign>
+class BlockPool {
+public:
+    static void* Allocate() {
+        auto& local = Local::Get();
+        if (!local.head) {
+            local.Refill();
+        }
+        auto* block = local.head;
+        local.head = block->next;
+        --local.count;
+        return block;
+    }
+
+    static void Deallocate(void* ptr) {
+        auto& local = Local::Get();
+        auto* block = static_cast<FreeBlock*>(ptr);
+        block->next = local.head;
+        local.head = block;
+        if (++local.count >= 2 * kBatch) {
+            local.GiveAway(kBatch);
+        }
+    }
+
+private:
+    struct FreeBlock {
+        FreeBlock* next;
+    };
+
+    struct Chain {
+        FreeBlock* head;
+        size_t count;
+    };
+
+    struct Shared {
+        std::mutex mutex;
+        std::vector<Chain> chains;
+        std::vector<std::unique_ptr<std::byte[]>> slabs;
+    };
+
+    // Never destroyed: nodes of a static map may outlive every other static object.
+    static Shared& GetShared() {
+        static auto* shared = new Shared;
+        return *shared;
+    }
+
+    struct Local {
+        FreeBlock* head = nullptr;
+        size_t count = 0;
+
+        static Local& Get() {
+            thread_local Local local;
+            return local;
+        }
+
+        ~Local() {
+            GiveAway(count);
+        }
+
+        void Refill() {
+            auto& shared = GetShared();
+            std::lock_guard lock(shared.mutex);
+            if (!shared.chains.empty()) {
+                head = shared.chains.back().head;
+                count = shared.chains.back().count;
+                shared.chains.pop_back();
+                return;
+            }
+            auto& slab = shared.slabs.emplace_back(new std::byte[kBatch * kBlockSize + kAlign]);
+            auto* begin = reinterpret_cast<std::byte*>(
+                (reinterpret_cast<uintptr_t>(slab.get()) + kAlign - 1) & ~(kAlign - 1));
+            for (size_t i = kBatch; i-- > 0;) {
+                auto* block = reinterpret_cast<FreeBlock*>(begin + i * kBlockSize);
+                block->next = head;
+                head = block;
+            }
+            count = kBatch;
+        }
+
+        void GiveAway(size_t n) {
+            if (n == 0) {
+                return;
+            }
+            Chain chain{head, n};
+            auto* last = head;
+            for (size_t i = 1; i < n; ++i) {
+                last = last->next;
+            }
+            head = last->next;
+            last->next = nullptr;
+            count -= n;
+
+            auto& shared = GetShared();
+            std::lock_guard lock(shared.mutex);
+            shared.chains.push_back(chain);
+        }
+    };
+
+    static constexpr size_t kBlockSize =
+        (std::max(kSize, sizeof(FreeBlock)) + kAlign - 1) / kAlign * kAlign;
+    static constexpr size_t kBatch = 64;
+};
+
+// Allocator that serves single objects from a per-thread BlockPool, the way node containers
+// allocate. Bulk allocations go to std::allocator.
+template <class T>
+class PoolAllocator {
+public:
+    using value_type = T;
+
+    PoolAllocator() = default;
+
+    template <class U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        if (n != 1) {
+            return std::allocator<T>{}.allocate(n);
+        }
+        return static_cast<T*>(Pool::Allocate());
+    }
+
+    void deallocate(T* ptr, size_t n) {
+        if (n != 1) {
+            std::allocator<T>{}.deallocate(ptr, n);
+            return;
+        }
+        Pool::Deallocate(ptr);
+    }
+
+    template <class U>
+    bool operator==(const PoolAllocator<U>&) const {
+        return true;
+    }
+
+private:
+    using Pool = BlockPool<sizeof(T), std::max(alignof(T), alignof(void*))>;
+};
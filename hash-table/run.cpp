@@ -2,8 +2,11 @@
 #include "runner.h"
 #include "concurrent_hash_map.h"
 
+#include <memory>
+#include <string>
 #include <thread>
 #include <ranges>
+#include <vector>
 
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/generators/catch_generators.hpp>
@@ -11,12 +14,14 @@
 
 static constexpr auto kSeed = 82'944'584;
 
-TEST_CASE("Benchmark") {
+template <class Storage>
+void RunBenchmarks(const std::string& storage_name) {
     const auto num_threads = GENERATE(2u, 4u, 8u);
     static constexpr auto kNumIterations = 1'000'000;
+    const auto suffix = ":" + storage_name + ":" + std::to_string(num_threads);
 
-    ConcurrentHashMap<int, int> map(kNumIterations, num_threads);
-    BENCHMARK("RandomInsertions:" + std::to_string(num_threads)) {
+    ConcurrentHashMap<int, int, std::hash<int>, Storage> map(kNumIterations, num_threads);
+    BENCHMARK("RandomInsertions" + suffix) {
         Runner runner{kNumIterations};
         for (auto i : std::views::iota(0u, num_threads)) {
             Random rand{kSeed + 10 * i};
@@ -25,7 +30,7 @@ TEST_CASE("Benchmark") {
     };
 
     map.Clear();
-    BENCHMARK("SpecialInsertions:" + std::to_string(num_threads)) {
+    BENCHMARK("SpecialInsertions" + suffix) {
         Runner runner{kNumIterations};
         EqualLowBits elb{16};
         runner.Do([&map, elb]() mutable { map.Insert(elb(), 1); });
@@ -36,7 +41,23 @@ TEST_CASE("Benchmark") {
     };
 
     map.Clear();
-    BENCHMARK("ManySearches:" + std::to_string(num_threads)) {
+    BENCHMARK("BatchInsertions" + suffix) {
+        static constexpr auto kBatchSize = 256;
+        Runner runner{kNumIterations / kBatchSize};
+        for (auto i : std::views::iota(0u, num_threads)) {
+            Random rand{kSeed + 10 * i};
+            runner.Do([&map, rand]() mutable {
+                std::vector<std::pair<int, int>> batch(kBatchSize);
+                for (auto& entry : batch) {
+                    entry = {rand(), 1};
+                }
+                map.InsertBatch(batch);
+            });
+        }
+    };
+
+    map.Clear();
+    BENCHMARK("ManySearches" + suffix) {
         Runner runner{kNumIterations};
         runner.Do([&map, rand = Random{kSeed - 1}]() mutable { map.Insert(rand(), 1); });
         for (auto i : std::views::iota(1u, num_threads)) {
@@ -46,7 +67,7 @@ TEST_CASE("Benchmark") {
     };
 
     map.Clear();
-    BENCHMARK("Deletions:" + std::to_string(num_threads)) {
+    BENCHMARK("Deletions" + suffix) {
         Runner runner{kNumIterations};
         for (auto i : std::views::iota(0u, num_threads)) {
             Random rand{kSeed + i / 2};
@@ -58,3 +79,50 @@ TEST_CASE("Benchmark") {
         }
     };
 }
+
+// Readers vastly outnumber the single writer, lookups should scale with the number of readers.
+template <class Storage>
+void RunReadMostlyBenchmark(const std::string& storage_name) {
+    const auto num_threads = GENERATE(16u, 32u);
+    static constexpr auto kNumKeys = 1'000'000;
+    static constexpr auto kNumIterations = 200'000;
+    const auto suffix = ":" + storage_name + ":" + std::to_string(num_threads);
+
+    ConcurrentHashMap<int, int, std::hash<int>, Storage> map(kNumKeys, num_threads);
+    for (auto i = 0; i < kNumKeys; i += 2) {
+        map.Insert(i, 1);
+    }
+    BENCHMARK("ReadMostly" + suffix) {
+        Runner runner{kNumIterations};
+        runner.Do([&map, rand = Random{kSeed, 0, kNumKeys}]() mutable {
+            auto key = rand();
+            if (!map.Insert(key, 1)) {
+                map.Erase(key);
+            }
+        });
+        for (auto i : std::views::iota(1u, num_threads)) {
+            Random rand{kSeed + i, 0, kNumKeys};
+            runner.Do([&map, rand]() mutable { map.Find(rand()); });
+        }
+    };
+}
+
+TEST_CASE("Benchmark") {
+    RunBenchmarks<ChainedStorage>("list");
+}
+
+TEST_CASE("Benchmark std allocator") {
+    RunBenchmarks<BasicChainedStorage<std::allocator>>("list-std");
+}
+
+TEST_CASE("Benchmark flat") {
+    RunBenchmarks<FlatStorage>("flat");
+}
+
+TEST_CASE("Benchmark read-mostly") {
+    RunReadMostlyBenchmark<ChainedStorage>("list");
+}
+
+TEST_CASE("Benchmark read-mostly flat") {
+    RunReadMostlyBenchmark<FlatStorage>("flat");
+}
@@ -1,7 +1,10 @@
 #include "commons.h"
 #include "concurrent_hash_map.h"
+#include "workload.h"
 
+#include <algorithm>
 #include <string>
+#include <string_view>
 #include <unordered_set>
 #include <ranges>
 
@@ -156,3 +159,461 @@ TEST_CASE("OneThreadInteraction") {
     }
     REQUIRE(table.Size() == total_size);
 }
+
+using FlatMap = ConcurrentHashMap<int, int, std::hash<int>, FlatStorage>;
+
+TEST_CASE("FlatOperations") {
+    FlatMap table;
+    REQUIRE(table.Insert(3, 1));
+    REQUIRE(table.Insert(2, 2));
+    REQUIRE_FALSE(table.Insert(2, 1));
+    REQUIRE(table.Find(2) == std::pair{true, 2});
+    REQUIRE_FALSE(table.Find(5).first);
+    REQUIRE(table.Erase(3));
+    REQUIRE_FALSE(table.Erase(3));
+    REQUIRE(table.Size() == 1);
+    REQUIRE_THROWS_AS(table.At(3), std::out_of_range);
+    table.Clear();
+    REQUIRE(table.Size() == 0);
+    REQUIRE(table.Insert(2, 3));
+    REQUIRE(table.At(2) == 3);
+}
+
+TEST_CASE("ZeroExpectedSize") {
+    ConcurrentHashMap<int, int> chained(0);
+    REQUIRE(chained.Insert(1, 1));
+    REQUIRE(chained.Find(1) == std::pair{true, 1});
+
+    FlatMap flat(0);
+    REQUIRE(flat.Insert(1, 1));
+    REQUIRE(flat.Find(1) == std::pair{true, 1});
+}
+
+TEST_CASE("FlatGrowthAndTombstones") {
+    static constexpr auto kCount = 10'000;
+
+    ConcurrentHashMap<std::string, int, std::hash<std::string>, FlatStorage> table(16, 1);
+    for (auto i = 0; i < kCount; ++i) {
+        REQUIRE(table.Insert(std::to_string(i), i));
+    }
+    for (auto round = 0; round < 3; ++round) {
+        for (auto i = 0; i < kCount; i += 2) {
+            REQUIRE(table.Erase(std::to_string(i)));
+        }
+        for (auto i = 0; i < kCount; i += 2) {
+            REQUIRE(table.Insert(std::to_string(i), -i));
+        }
+    }
+    REQUIRE(table.Size() == kCount);
+    for (auto i = 0; i < kCount; ++i) {
+        REQUIRE(table.At(std::to_string(i)) == (i % 2 ? i : -i));
+    }
+}
+
+TEST_CASE("FlatInsertions") {
+    Tester<true, FlatMap> tester;
+    for (auto i = 0; i < 4; ++i) {
+        tester.AddTask<QueryType::INSERT>(Random{kSeed + i});
+    }
+}
+
+TEST_CASE("FlatSearching") {
+    Tester<true, FlatMap> tester;
+    tester.AddTask<QueryType::INSERT>(Random{kSeed - 1});
+    tester.AddTask<QueryType::FIND>(Random{kSeed - 2});
+    tester.AddTask<QueryType::INSERT>(EqualLowBits{16});
+    tester.AddTask<QueryType::FIND>(Increment{0});
+}
+
+TEST_CASE("FlatErasing") {
+    Tester<false, FlatMap> tester{1'000};
+    tester.AddTask<QueryType::INSERT>(Random{kSeed + 100});
+    tester.AddTask<QueryType::ERASE>(Random{kSeed + 100});
+    tester.AddTask<QueryType::INSERT>(Increment{100});
+    tester.AddTask<QueryType::ERASE>(Increment{-100});
+    tester.AddTask<QueryType::FIND>(Random{19, 100, 200});
+    tester.AddTask<QueryType::CLEAR>(Increment{0});
+}
+
+template <class Storage>
+void CheckIncrementalRehash() {
+    static constexpr auto kCount = 50'000;
+
+    ConcurrentHashMap<int, int, std::hash<int>, Storage> table(1, 1);
+    for (auto i = 0; i < kCount; ++i) {
+        REQUIRE(table.Insert(i, i));
+        REQUIRE_FALSE(table.Insert(i / 2, 0));
+        REQUIRE(table.Find(i / 3) == std::pair{true, i / 3});
+        if (i % 5 == 0) {
+            REQUIRE(table.Erase(i / 5 * 4));
+            REQUIRE(table.Insert(i / 5 * 4, i / 5 * 4));
+        }
+    }
+    REQUIRE(table.Size() == kCount);
+    for (auto i = 0; i < kCount; ++i) {
+        REQUIRE(table.At(i) == i);
+    }
+}
+
+TEST_CASE("IncrementalRehash") {
+    CheckIncrementalRehash<ChainedStorage>();
+    CheckIncrementalRehash<FlatStorage>();
+}
+
+TEST_CASE("LockFreeReads") {
+    static constexpr auto kNumReaders = 3;
+    static constexpr auto kKeys = 20'000;
+
+    ConcurrentHashMap<int, int64_t, std::hash<int>, FlatStorage> table(16, 1);
+    std::atomic_flag done;
+    std::vector<std::jthread> readers;
+    for (auto i = 0; i < kNumReaders; ++i) {
+        readers.emplace_back([&table, &done, i] {
+            Random random{kSeed + i, 0, kKeys};
+            while (!done.test()) {
+                auto key = random();
+                if (auto [found, value] = table.Find(key); found) {
+                    REQUIRE(value == int64_t{key} * 1'000'000'007);
+                }
+            }
+        });
+    }
+
+    for (auto round = 0; round < 3; ++round) {
+        for (auto key = 0; key < kKeys; ++key) {
+            table.Insert(key, int64_t{key} * 1'000'000'007);
+        }
+        for (auto key = round % 2; key < kKeys; key += 2) {
+            table.Erase(key);
+        }
+    }
+    done.test_and_set();
+    readers.clear();
+    for (auto key = 0; key < kKeys; ++key) {
+        REQUIRE(table.Find(key).first == (key % 2 == 1));
+    }
+}
+
+template <class Storage>
+void CheckBatches() {
+    static constexpr auto kCount = 10'000;
+
+    ConcurrentHashMap<int, int, std::hash<int>, Storage> table(1, 2);
+    std::vector<std::pair<int, int>> entries;
+    for (auto i = 0; i < kCount; ++i) {
+        entries.emplace_back(i, i);
+    }
+    entries.emplace_back(7, -7);
+    REQUIRE(table.InsertBatch(entries) == kCount);
+    REQUIRE(table.Size() == kCount);
+    REQUIRE(table.InsertBatch(entries) == 0);
+
+    std::vector<int> keys;
+    for (auto i = 0; i < 2 * kCount; i += 2) {
+        keys.push_back(i);
+    }
+    keys.push_back(0);
+    REQUIRE(table.EraseBatch(keys) == kCount / 2);
+    REQUIRE(table.Size() == kCount / 2);
+
+    keys.clear();
+    for (auto i = kCount; i >= 0; --i) {
+        keys.push_back(i);
+    }
+    auto found = table.FindBatch(keys);
+    REQUIRE(found.size() == keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        auto key = keys[i];
+        REQUIRE(found[i] == table.Find(key));
+        REQUIRE(found[i].first == (key % 2 == 1 && key < kCount));
+    }
+    REQUIRE(table.FindBatch({}).empty());
+}
+
+TEST_CASE("Batches") {
+    CheckBatches<ChainedStorage>();
+    CheckBatches<FlatStorage>();
+}
+
+template <class Storage>
+void CheckInPlaceUpdates() {
+    ConcurrentHashMap<std::string, std::string, std::hash<std::string>, Storage> table;
+    REQUIRE(table.TryEmplace("a", 3, 'x'));
+    REQUIRE_FALSE(table.TryEmplace("a", 5, 'y'));
+    REQUIRE(table.At("a") == "xxx");
+
+    REQUIRE(table.InsertOrAssign("b", "1"));
+    std::string value = "2";
+    REQUIRE_FALSE(table.InsertOrAssign("b", std::move(value)));
+    REQUIRE(table.At("b") == "2");
+
+    auto append = [](std::string& value) { value += "!"; };
+    REQUIRE(table.Update("a", append));
+    REQUIRE_FALSE(table.Update("c", append));
+    REQUIRE(table.At("a") == "xxx!");
+    REQUIRE(table.Upsert("c", "0", append));
+    REQUIRE_FALSE(table.Upsert("c", "0", append));
+    REQUIRE(table.At("c") == "0!");
+    REQUIRE(table.Size() == 3);
+}
+
+TEST_CASE("InPlaceUpdates") {
+    CheckInPlaceUpdates<ChainedStorage>();
+    CheckInPlaceUpdates<FlatStorage>();
+}
+
+TEST_CASE("ConcurrentCounters") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kIterations = 20'000;
+    static constexpr auto kKeys = 100;
+
+    ConcurrentHashMap<int, int, std::hash<int>, FlatStorage> table(1, kNumThreads);
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&table] {
+            for (auto j = 0; j < kIterations; ++j) {
+                table.Upsert(j % kKeys, 1, [](int& counter) { ++counter; });
+            }
+        });
+    }
+    threads.clear();
+
+    REQUIRE(table.Size() == kKeys);
+    REQUIRE(table.ExactSize() == kKeys);
+    for (auto key = 0; key < kKeys; ++key) {
+        REQUIRE(table.At(key) == kNumThreads * kIterations / kKeys);
+    }
+}
+
+TEST_CASE("ShardedSize") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kKeysPerThread = 10'000;
+
+    ConcurrentHashMap<int, int> table(kNumThreads);
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&table, i] {
+            for (auto key = i * kKeysPerThread; key < (i + 1) * kKeysPerThread; ++key) {
+                table.Insert(key, key);
+                if (key % 2) {
+                    table.Erase(key);
+                }
+            }
+        });
+    }
+    threads.emplace_back([&table] {
+        for (auto i = 0; i < 100; ++i) {
+            REQUIRE(table.ExactSize() <= kNumThreads * kKeysPerThread);
+        }
+    });
+    threads.clear();
+
+    REQUIRE(table.Size() == kNumThreads * kKeysPerThread / 2);
+    REQUIRE(table.ExactSize() == table.Size());
+    table.Clear();
+    REQUIRE(table.Size() == 0);
+}
+
+struct StringHash {
+    using is_transparent = void;
+
+    size_t operator()(std::string_view str) const {
+        return std::hash<std::string_view>{}(str);
+    }
+};
+
+struct Point {
+    int x;
+    int y;
+};
+
+struct PointHash {
+    size_t operator()(const Point& point) const {
+        return 17239u * point.x + point.y;
+    }
+};
+
+struct PointEqual {
+    bool operator()(const Point& lhs, const Point& rhs) const {
+        return lhs.x == rhs.x && lhs.y == rhs.y;
+    }
+};
+
+template <class Storage>
+void CheckCustomKeys() {
+    ConcurrentHashMap<std::string, int, StringHash, Storage, std::equal_to<>> strings;
+    REQUIRE(strings.Insert("key", 1));
+    std::string_view view = "a key from a buffer";
+    REQUIRE(strings.Insert(std::string(view), 2));
+    REQUIRE(strings.Find(view.substr(2, 3)) == std::pair{true, 1});
+    REQUIRE(strings.At(view) == 2);
+    REQUIRE(strings.Update(view, [](int& value) { value *= 10; }));
+    REQUIRE(strings.At(std::string(view)) == 20);
+    REQUIRE(strings.Erase(view));
+    REQUIRE_FALSE(strings.Find(view).first);
+
+    ConcurrentHashMap<Point, int, PointHash, Storage, PointEqual> points(1, 1);
+    for (auto i = 0; i < 1'000; ++i) {
+        REQUIRE(points.Insert({i, -i}, i));
+    }
+    REQUIRE_FALSE(points.Insert({5, -5}, 0));
+    REQUIRE(points.At({7, -7}) == 7);
+    REQUIRE_FALSE(points.Find({7, 7}).first);
+}
+
+TEST_CASE("CustomKeys") {
+    CheckCustomKeys<ChainedStorage>();
+    CheckCustomKeys<FlatStorage>();
+}
+
+template <class Storage>
+void CheckIteration() {
+    static constexpr auto kCount = 10'000;
+
+    ConcurrentHashMap<int, int, std::hash<int>, Storage> table(1, 2);
+    for (auto i = 0; i < kCount; ++i) {
+        table.Insert(i, i);
+    }
+
+    int64_t sum = 0;
+    table.ForEach([&sum](int key, int value) {
+        REQUIRE(key == value);
+        sum += value;
+    });
+    REQUIRE(sum == int64_t{kCount} * (kCount - 1) / 2);
+
+    std::atomic<int64_t> parallel_sum = 0;
+    table.ForEachParallel([&parallel_sum](int, int value) { parallel_sum += value; }, 3);
+    REQUIRE(parallel_sum == sum);
+
+    auto snapshot = table.Snapshot();
+    std::ranges::sort(snapshot);
+    REQUIRE(snapshot.size() == kCount);
+    for (auto i = 0; i < kCount; ++i) {
+        REQUIRE(snapshot[i] == std::pair{i, i});
+    }
+}
+
+TEST_CASE("Iteration") {
+    CheckIteration<ChainedStorage>();
+    CheckIteration<FlatStorage>();
+}
+
+TEST_CASE("IterationWithWriters") {
+    static constexpr auto kStable = 5'000;
+
+    FlatMap table(1, 2);
+    for (auto i = 0; i < kStable; ++i) {
+        table.Insert(i, i);
+    }
+    std::atomic_flag done;
+    std::jthread writer([&table, &done] {
+        for (auto i = kStable; !done.test(); ++i) {
+            table.Insert(i, i);
+            table.Erase(i - 100);
+        }
+    });
+
+    for (auto round = 0; round < 20; ++round) {
+        int stable_seen = 0;
+        table.ForEach([&stable_seen](int key, int value) {
+            REQUIRE(key == value);
+            stable_seen += key >= 0 && key < kStable - 100;
+        });
+        REQUIRE(stable_seen == kStable - 100);
+    }
+    done.test_and_set();
+}
+
+TEST_CASE("PoolAllocator") {
+    static constexpr auto kNumThreads = 4;
+    static constexpr auto kCount = 10'000;
+
+    PoolAllocator<int64_t> allocator;
+    std::vector<std::vector<int64_t*>> blocks(kNumThreads);
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&allocator, &blocks, i] {
+            for (auto j = 0; j < kCount; ++j) {
+                auto* ptr = allocator.allocate(1);
+                *ptr = int64_t{i} * kCount + j;
+                blocks[i].push_back(ptr);
+            }
+        });
+    }
+    threads.clear();
+
+    std::unordered_set<int64_t*> unique;
+    for (auto i = 0; i < kNumThreads; ++i) {
+        for (auto j = 0; j < kCount; ++j) {
+            REQUIRE(*blocks[i][j] == int64_t{i} * kCount + j);
+            unique.insert(blocks[i][j]);
+        }
+    }
+    REQUIRE(unique.size() == kNumThreads * kCount);
+
+    // Every thread frees the blocks of its neighbour, so free lists cross threads.
+    for (auto i = 0; i < kNumThreads; ++i) {
+        threads.emplace_back([&allocator, &blocks, i] {
+            for (auto* ptr : blocks[(i + 1) % kNumThreads]) {
+                allocator.deallocate(ptr, 1);
+            }
+        });
+    }
+    threads.clear();
+
+    auto* array = allocator.allocate(10);
+    allocator.deallocate(array, 10);
+}
+
+TEST_CASE("StdAllocatorStorage") {
+    Tester<true, ConcurrentHashMap<int, int, std::hash<int>, BasicChainedStorage<std::allocator>>>
+        tester;
+    for (auto i = 0; i < 4; ++i) {
+        tester.AddTask<QueryType::INSERT>(Random{kSeed + i});
+    }
+}
+
+TEST_CASE("ZipfDistribution") {
+    static constexpr auto kSamples = 100'000;
+
+    std::mt19937_64 gen{kSeed};
+    ZipfDistribution zipf{1'000, 0.99};
+    std::vector<int> counts(1'000);
+    for (auto i = 0; i < kSamples; ++i) {
+        auto key = zipf(gen);
+        REQUIRE(key < 1'000);
+        ++counts[key];
+    }
+    REQUIRE(counts[0] > counts[1]);
+    REQUIRE(counts[1] > counts[10]);
+    REQUIRE(counts[0] > kSamples / 10);
+
+    ZipfDistribution uniform{1'000, 0};
+    std::ranges::fill(counts, 0);
+    for (auto i = 0; i < kSamples; ++i) {
+        ++counts[uniform(gen)];
+    }
+    REQUIRE(std::ranges::max(counts) < 3 * kSamples / 1'000);
+}
+
+TEST_CASE("LatencyHistogram") {
+    LatencyHistogram histogram;
+    REQUIRE(histogram.Percentile(0.5) == 0);
+    for (uint64_t ns = 1; ns <= 10'000; ++ns) {
+        histogram.Add(ns);
+    }
+    LatencyHistogram other;
+    other.Add(1'000'000);
+    histogram.Merge(other);
+
+    REQUIRE(histogram.Count() == 10'001);
+    REQUIRE(histogram.Max() == 1'000'000);
+    auto p50 = histogram.Percentile(0.5);
+    REQUIRE(p50 >= 5'000);
+    REQUIRE(p50 <= 5'000 * 17 / 16);
+    auto p99 = histogram.Percentile(0.99);
+    REQUIRE(p99 >= 9'900);
+    REQUIRE(p99 <= 9'900 * 17 / 16);
+    REQUIRE(histogram.Percentile(1) == 1'000'000);
+}
@@ -0,0 +1,167 @@
+#include "workload.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Usage: run_hash_table_workload [--option=value ...]
+//   --storage=list,flat          storage policies to run
+//   --threads=1,4,16             worker thread counts
+//   --keys=10000,1000000         key space sizes, half of every key space is prefilled
+//   --mix=95/5/0,50/25/25        find/insert/erase weights
+//   --zipf=0.99                  Zipf skew in [0, 1), 0 is uniform
+//   --operations=1000000         operations per run, shared by all threads
+//   --seed=82944584
+// Every combination of the listed values is one run. The results go to stdout as a JSON array.
+
+namespace {
+
+std::vector<std::string> Split(std::string_view str, char delimiter) {
+    std::vector<std::string> parts;
+    std::string part;
+    std::istringstream in{std::string{str}};
+    while (std::getline(in, part, delimiter)) {
+        parts.push_back(part);
+    }
+    return parts;
+}
+
+template <class T>
+T Parse(const std::string& str) {
+    std::istringstream in{str};
+    T value;
+    if (!(in >> value) || !in.eof()) {
+        throw std::invalid_argument{"Bad value: " + str};
+    }
+    return value;
+}
+
+OperationMix ParseMix(const std::string& str) {
+    auto weights = Split(str, '/');
+    if (weights.size() != 3) {
+        throw std::invalid_argument{"Mix must be find/insert/erase: " + str};
+    }
+    OperationMix mix{Parse<int>(weights[0]), Parse<int>(weights[1]), Parse<int>(weights[2])};
+    if (mix.find < 0 || mix.insert < 0 || mix.erase < 0 ||
+        mix.find + mix.insert + mix.erase == 0) {
+        throw std::invalid_argument{"Bad mix: " + str};
+    }
+    return mix;
+}
+
+struct Options {
+    std::vector<std::string> storages = {"list", "flat"};
+    std::vector<int> threads = {1, 4, 16};
+    // Roughly L2, L3 and DRAM sized tables.
+    std::vector<uint64_t> keys = {10'000, 1'000'000, 50'000'000};
+    std::vector<OperationMix> mixes = {{95, 5, 0}, {50, 25, 25}};
+    double zipf_theta = 0.99;
+    uint64_t num_operations = 1'000'000;
+    uint32_t seed = 82'944'584;
+};
+
+Options ParseOptions(int argc, char* argv[]) {
+    Options options;
+    for (auto i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        const auto eq = arg.find('=');
+        if (!arg.starts_with("--") || eq == std::string_view::npos) {
+            throw std::invalid_argument{"Expected --option=value, got " + std::string{arg}};
+        }
+        const auto name = arg.substr(2, eq - 2);
+        const auto values = Split(arg.substr(eq + 1), ',');
+        if (values.empty()) {
+            throw std::invalid_argument{"No value for " + std::string{name}};
+        }
+        if (name == "storage") {
+            options.storages = values;
+        } else if (name == "threads") {
+            options.threads.clear();
+            for (const auto& value : values) {
+                options.threads.push_back(Parse<int>(value));
+            }
+        } else if (name == "keys") {
+            options.keys.clear();
+            for (const auto& value : values) {
+                options.keys.push_back(Parse<uint64_t>(value));
+            }
+        } else if (name == "mix") {
+            options.mixes.clear();
+            for (const auto& value : values) {
+                options.mixes.push_back(ParseMix(value));
+            }
+        } else if (name == "zipf") {
+            options.zipf_theta = Parse<double>(values.front());
+        } else if (name == "operations") {
+            options.num_operations = Parse<uint64_t>(values.front());
+        } else if (name == "seed") {
+            options.seed = Parse<uint32_t>(values.front());
+        } else {
+            throw std::invalid_argument{"Unknown option " + std::string{name}};
+        }
+    }
+    if (options.zipf_theta < 0 || options.zipf_theta >= 1) {
+        throw std::invalid_argument{"Zipf theta must be in [0, 1)"};
+    }
+    if (std::ranges::any_of(options.threads, [](int threads) { return threads < 1; })) {
+        throw std::invalid_argument{"Thread counts must be positive"};
+    }
+    // The map takes its expected size as an int.
+    if (std::ranges::any_of(options.keys, [](uint64_t keys) {
+            return keys < 1 || keys > std::numeric_limits<int>::max();
+        })) {
+        throw std::invalid_argument{"Key counts must be in [1, INT_MAX]"};
+    }
+    return options;
+}
+
+WorkloadResult Run(const WorkloadConfig& config) {
+    if (config.storage == "list") {
+        return RunWorkload<ChainedStorage>(config);
+    } else if (config.storage == "flat") {
+        return RunWorkload<FlatStorage>(config);
+    } else {
+        throw std::invalid_argument{"Unknown storage " + config.storage};
+    }
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+    try {
+        const auto options = ParseOptions(argc, argv);
+        auto first = true;
+        std::cout << "[\n";
+        for (const auto& storage : options.storages) {
+            for (auto num_keys : options.keys) {
+                for (const auto& mix : options.mixes) {
+                    for (auto num_threads : options.threads) {
+                        const WorkloadConfig config{.storage = storage,
+                                                    .num_threads = num_threads,
+                                                    .num_keys = num_keys,
+                                                    .num_operations = options.num_operations,
+                                                    .mix = mix,
+                                                    .zipf_theta = options.zipf_theta,
+                                                    .seed = options.seed};
+                        const auto result = Run(config);
+                        std::cout << (first ? "  " : ",\n  ");
+                        WriteJson(std::cout, config, result);
+                        std::cout.flush();
+                        first = false;
+                    }
+                }
+            }
+        }
+        std::cout << "\n]\n";
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
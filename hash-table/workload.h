@@ -0,0 +1,204 @@
+#pragma once
+
+#include "concurrent_hash_map.h"
+#include "runner.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <random>
+#include <string>
+#include <vector>
+
+// Zipf distribution over [0, n) as in Gray et al., "Quickly Generating Billion-Record Synthetic
+// Databases": O(n) setup, O(1) per sample. Rank 0 is the hottest key. theta = 0 is uniform.
+class ZipfDistribution {
+public:
+    ZipfDistribution(uint64_t n, double theta)
+        : n_(n),
+          theta_(theta),
+          zeta_n_(Zeta(n, theta)),
+          alpha_(1 / (1 - theta)),
+          eta_((1 - std::pow(2.0 / n, 1 - theta)) / (1 - Zeta(2, theta) / zeta_n_)) {
+    }
+
+    template <class Generator>
+    uint64_t operator()(Generator& gen) const {
+        const auto u = std::uniform_real_distribution<double>{}(gen);
+        if (theta_ == 0) {
+            return std::min<uint64_t>(u * n_, n_ - 1);
+        }
+        const auto uz = u * zeta_n_;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + std::pow(0.5, theta_)) {
+            return 1;
+        }
+        return std::min<uint64_t>(n_ * std::pow(eta_ * u - eta_ + 1, alpha_), n_ - 1);
+    }
+
+private:
+    static double Zeta(uint64_t n, double theta) {
+        double sum = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            sum += 1 / std::pow(i, theta);
+        }
+        return sum;
+    }
+
+    const uint64_t n_;
+    const double theta_;
+    const double zeta_n_;
+    const double alpha_;
+    const double eta_;
+};
+
+// Log-linear histogram of nanosecond latencies: every power of two is split into kSubBuckets,
+// so a reported percentile is at most 1 / kSubBuckets above the real one.
+class LatencyHistogram {
+public:
+    void Add(uint64_t ns) {
+        ++counts_[BucketOf(ns)];
+        ++total_;
+        max_ = std::max(max_, ns);
+    }
+
+    void Merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        max_ = std::max(max_, other.max_);
+    }
+
+    // Upper bound of the bucket holding the q-th quantile.
+    uint64_t Percentile(double q) const {
+        const auto rank = static_cast<uint64_t>(std::ceil(q * total_));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank && seen > 0) {
+                return std::min(UpperBound(i), max_);
+            }
+        }
+        return max_;
+    }
+
+    uint64_t Max() const {
+        return max_;
+    }
+
+    uint64_t Count() const {
+        return total_;
+    }
+
+private:
+    static constexpr int kSubBucketBits = 4;
+    static constexpr uint64_t kSubBuckets = 1 << kSubBucketBits;
+
+    // Values below kSubBuckets get a bucket each, above that the top kSubBucketBits + 1 bits
+    // select the bucket.
+    static size_t BucketOf(uint64_t ns) {
+        if (ns < kSubBuckets) {
+            return ns;
+        }
+        const auto shift = std::bit_width(ns) - kSubBucketBits - 1;
+        return (shift + 1) * kSubBuckets + ((ns >> shift) - kSubBuckets);
+    }
+
+    static uint64_t UpperBound(size_t bucket) {
+        if (bucket < kSubBuckets) {
+            return bucket;
+        }
+        const auto shift = bucket / kSubBuckets - 1;
+        return ((bucket % kSubBuckets + kSubBuckets + 1) << shift) - 1;
+    }
+
+    std::array<uint64_t, (64 - kSubBucketBits + 1) * kSubBuckets> counts_{};
+    uint64_t total_ = 0;
+    uint64_t max_ = 0;
+};
+
+struct OperationMix {
+    int find;
+    int insert;
+    int erase;
+};
+
+struct WorkloadConfig {
+    std::string storage;
+    int num_threads;
+    uint64_t num_keys;
+    uint64_t num_operations;
+    OperationMix mix;
+    double zipf_theta;
+    uint32_t seed;
+};
+
+struct WorkloadResult {
+    double seconds;
+    LatencyHistogram latency;
+};
+
+// Prefills every other key of the key space, then num_threads workers share num_operations
+// operations drawn from the mix, with keys drawn from the Zipf distribution. Each operation
+// is timed separately, the two clock reads add a few tens of nanoseconds to every sample.
+template <class Storage>
+WorkloadResult RunWorkload(const WorkloadConfig& config) {
+    using Clock = std::chrono::steady_clock;
+
+    ConcurrentHashMap<uint64_t, uint64_t, std::hash<uint64_t>, Storage> map(
+        static_cast<int>(config.num_keys), config.num_threads);
+    for (uint64_t key = 0; key < config.num_keys; key += 2) {
+        map.Insert(key, key);
+    }
+
+    const ZipfDistribution keys{config.num_keys, config.zipf_theta};
+    const auto total_weight = config.mix.find + config.mix.insert + config.mix.erase;
+    std::vector<LatencyHistogram> histograms(config.num_threads);
+    const auto start = Clock::now();
+    {
+        Runner runner{config.num_operations};
+        for (auto i = 0; i < config.num_threads; ++i) {
+            runner.Do([&map, &keys, &config, total_weight, histogram = &histograms[i],
+                       gen = std::mt19937_64{config.seed + i}]() mutable {
+                const auto key = keys(gen);
+                const auto op = std::uniform_int_distribution{0, total_weight - 1}(gen);
+                const auto op_start = Clock::now();
+                if (op < config.mix.find) {
+                    map.Find(key);
+                } else if (op < config.mix.find + config.mix.insert) {
+                    map.Insert(key, key);
+                } else {
+                    map.Erase(key);
+                }
+                histogram->Add((Clock::now() - op_start) / std::chrono::nanoseconds{1});
+            });
+        }
+    }
+    WorkloadResult result{std::chrono::duration<double>(Clock::now() - start).count(), {}};
+    for (const auto& histogram : histograms) {
+        result.latency.Merge(histogram);
+    }
+    return result;
+}
+
+// One JSON object per run, the driver prints them as an array.
+inline void WriteJson(std::ostream& out, const WorkloadConfig& config,
+                      const WorkloadResult& result) {
+    const auto& latency = result.latency;
+    out << "{\"storage\": \"" << config.storage << "\", \"threads\": " << config.num_threads
+        << ", \"keys\": " << config.num_keys << ", \"operations\": " << config.num_operations
+        << ", \"mix\": {\"find\": " << config.mix.find << ", \"insert\": " << config.mix.insert
+        << ", \"erase\": " << config.mix.erase << "}, \"zipf\": " << config.zipf_theta
+        << ", \"seconds\": " << result.seconds
+        << ", \"ops_per_second\": " << config.num_operations / result.seconds
+        << ", \"latency_ns\": {\"p50\": " << latency.Percentile(0.5)
+        << ", \"p99\": " << latency.Percentile(0.99) << ", \"p999\": " << latency.Percentile(0.999)
+        << ", \"max\": " << latency.Max() << "}}";
+}
@@ -0,0 +1,137 @@
+#include "epoch.h"
+
+#include <utility>
+#include <vector>
+
+namespace epoch {
+
+namespace {
+
+// Deleters may retire more pointers, so a list is detached before they run.
+void Free(std::vector<RetiredPtr> ptrs) {
+    for (auto& ptr : ptrs) {
+        ptr.Free();
+    }
+}
+
+void PushOrphans(RetiredBatch* first, RetiredBatch* last) {
+    last->next = orphans.load();
+    while (!orphans.compare_exchange_weak(last->next, first)) {
+    }
+}
+
+// Frees the orphans retired before safe_epoch, or all of them if everything is safe.
+void FreeOrphans(uint64_t safe_epoch, bool all) {
+    RetiredBatch* keep = nullptr;
+    RetiredBatch* keep_last = nullptr;
+    for (auto* batch = orphans.exchange(nullptr); batch;) {
+        auto* next = batch->next;
+        if (all || batch->epoch < safe_epoch) {
+            Free(std::move(batch->retired));
+            delete batch;
+        } else {
+            batch->next = keep;
+            keep = batch;
+            if (!keep_last) {
+                keep_last = batch;
+            }
+        }
+        batch = next;
+    }
+    if (keep) {
+        PushOrphans(keep, keep_last);
+    }
+}
+
+void FreeExpired(uint64_t epoch) {
+    for (size_t i = 0; i < kBins; ++i) {
+        if (retired.epochs[i] + 2 <= epoch && !retired.bins[i].empty()) {
+            Free(std::exchange(retired.bins[i], {}));
+        }
+    }
+    if (orphans.load(std::memory_order_relaxed) && epoch >= 2) {
+        FreeOrphans(epoch - 1, false);
+    }
+}
+
+}  // namespace
+
+void RegisterThread() {
+    // The first access to retired schedules its destructor, which unregisters the thread.
+    retired.retired_since_advance += 0;
+    ++num_active_threads;
+    for (auto* state = threads.load(); state; state = state->next) {
+        auto expected = false;
+        if (!state->active.load(std::memory_order_relaxed) &&
+            state->active.compare_exchange_strong(expected, true)) {
+            local.state = state;
+            return;
+        }
+    }
+
+    auto* state = new ThreadState;
+    state->active.store(true, std::memory_order_relaxed);
+    state->next = threads.load();
+    while (!threads.compare_exchange_weak(state->next, state)) {
+    }
+    ++num_thread_states;
+    local.state = state;
+}
+
+void TryAdvance() {
+    auto epoch = global_epoch.load();
+    auto all_seen = true;
+    for (auto* state = threads.load(); state; state = state->next) {
+        const auto announced = state->announced.load();
+        if ((announced & 1) && (announced >> 1) != epoch) {
+            all_seen = false;
+            break;
+        }
+    }
+    // On failure another thread has advanced, and epoch is reloaded.
+    if (all_seen && global_epoch.compare_exchange_strong(epoch, epoch + 1)) {
+        ++epoch;
+    }
+    FreeExpired(epoch);
+}
+
+void Flush() {
+    for (size_t i = 0; i < kBins; ++i) {
+        TryAdvance();
+    }
+}
+
+void ReuseBin(size_t index, uint64_t epoch) {
+    retired.epochs[index] = epoch;
+    Free(std::exchange(retired.bins[index], {}));
+}
+
+RetiredBins::~RetiredBins() {
+    auto last = false;
+    if (auto* state = std::exchange(local.state, nullptr)) {
+        state->announced.store(0);
+        state->active.store(false);
+        last = num_active_threads.fetch_sub(1) == 1;
+    } else {
+        last = num_active_threads.load() == 0;
+    }
+
+    // With no thread registered, nobody is inside a critical section, and a thread that enters
+    // one later cannot reach pointers that were already retired.
+    for (size_t i = 0; i < kBins; ++i) {
+        if (bins[i].empty()) {
+            continue;
+        }
+        if (last) {
+            Free(std::exchange(bins[i], {}));
+        } else {
+            auto* batch = new RetiredBatch{epochs[i], std::exchange(bins[i], {}), nullptr};
+            PushOrphans(batch, batch);
+        }
+    }
+    if (last) {
+        FreeOrphans(0, true);
+    }
+}
+
+}  // namespace epoch
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "retired_ptr.h"
+
+// Epoch-based reclamation. A thread inside a critical section announces the global epoch it has
+// seen, and the epoch advances only when every such thread has announced the current value. A
+// pointer retired in epoch e was unlinked before any reader of epoch e + 1 entered, so once the
+// epoch reaches e + 2 nobody can hold it. Unlike hazard pointers, a reader pays one store per
+// critical section instead of one per pointer, but a stalled reader stops all reclamation.
+namespace epoch {
+
+// Pointers retired in the current and the previous epoch may still be read, the third bin
+// holds older ones and is freed when it is reused.
+constexpr size_t kBins = 3;
+
+using ::RetiredPtr;
+
+// Retired pointers left over by a thread that exited, freed once their epoch is old enough.
+struct RetiredBatch {
+    uint64_t epoch;
+    std::vector<RetiredPtr> retired;
+    RetiredBatch* next;
+};
+
+// Registry records, reused like the hazard pointer ones. announced is zero outside critical
+// sections, otherwise the epoch shifted left by one with the low bit set.
+struct ThreadState {
+    std::atomic<uint64_t> announced = 0;
+    std::atomic<bool> active = false;
+    ThreadState* next = nullptr;
+};
+
+inline std::atomic<uint64_t> global_epoch = 0;
+inline std::atomic<ThreadState*> threads = nullptr;
+inline std::atomic_size_t num_thread_states = 0;
+inline std::atomic_size_t num_active_threads = 0;
+inline std::atomic<RetiredBatch*> orphans = nullptr;
+
+// A thread registers on its first critical section. Trivially destructible, so that accessing
+// it costs no more than the hazard pointer thread_state.
+struct LocalState {
+    ThreadState* state = nullptr;
+    int depth = 0;
+    // Slots held through EpochReclamation::Acquire.
+    unsigned held = 0;
+};
+
+inline thread_local LocalState local;
+
+// Unregisters the thread when it exits and hands what it could not free yet to the orphans.
+struct RetiredBins {
+    std::array<std::vector<RetiredPtr>, kBins> bins;
+    std::array<uint64_t, kBins> epochs{};
+    size_t retired_since_advance = 0;
+
+    ~RetiredBins();
+};
+
+inline thread_local RetiredBins retired;
+
+void RegisterThread();
+
+// Advances the epoch if every thread in a critical section has seen the current one, then frees
+// the bins and orphans that became safe.
+void TryAdvance();
+
+// Frees everything retired so far, provided that no thread is inside a critical section. Must
+// not be called from one.
+void Flush();
+
+// Frees the bin before it takes pointers of a new epoch: it holds epoch e - 3 or older.
+void ReuseBin(size_t index, uint64_t epoch);
+
+constexpr size_t kMinRetiredToAdvance = 16;
+
+// An advance reads every thread's announcement, so it runs after that many retires.
+inline size_t AdvanceThreshold() {
+    return std::max(kMinRetiredToAdvance,
+                    2 * num_thread_states.load(std::memory_order_relaxed));
+}
+
+// Critical sections nest. The announcement is a seq_cst store, so no pointer read inside the
+// section can be ordered before it.
+inline void EnterCritical() {
+    if (local.depth++ > 0) {
+        return;
+    }
+    if (!local.state) {
+        RegisterThread();
+    }
+    local.state->announced.store((global_epoch.load() << 1) | 1);
+}
+
+inline void ExitCritical() {
+    if (--local.depth == 0) {
+        local.state->announced.store(0, std::memory_order_release);
+    }
+}
+
+class CriticalGuard {
+public:
+    CriticalGuard() {
+        EnterCritical();
+    }
+
+    ~CriticalGuard() {
+        ExitCritical();
+    }
+
+    CriticalGuard(const CriticalGuard&) = delete;
+    CriticalGuard& operator=(const CriticalGuard&) = delete;
+};
+
+// Same signature as the hazard pointer Retire. May be called outside critical sections.
+template <class T, class Deleter = std::default_delete<T>>
+inline void Retire(T* value, Deleter deleter = {}) {
+    const auto epoch = global_epoch.load(std::memory_order_acquire);
+    const auto index = epoch % kBins;
+    if (retired.epochs[index] != epoch) {
+        ReuseBin(index, epoch);
+    }
+    retired.bins[index].emplace_back(value, std::move(deleter));
+
+    if (++retired.retired_since_advance >= AdvanceThreshold()) {
+        retired.retired_since_advance = 0;
+        TryAdvance();
+    }
+}
+
+}  // namespace epoch
+
+// Reclamation policy with the interface of HazardPointers. The first acquired slot enters a
+// critical section and releasing the last one leaves it, so a thread must release every slot
+// it acquired before it blocks or the epoch cannot advance.
+struct EpochReclamation {
+    template <class T>
+    static T* Acquire(std::atomic<T*>* ptr, size_t slot = 0) {
+        const auto bit = 1u << slot;
+        if (!(epoch::local.held & bit)) {
+            if (!epoch::local.held) {
+                epoch::EnterCritical();
+            }
+            epoch::local.held |= bit;
+        }
+        return ptr->load();
+    }
+
+    static void Release(size_t slot = 0) {
+        const auto bit = 1u << slot;
+        if (epoch::local.held & bit) {
+            epoch::local.held &= ~bit;
+            if (!epoch::local.held) {
+                epoch::ExitCritical();
+            }
+        }
+    }
+
+    template <class T, class Deleter = std::default_delete<T>>
+    static void Retire(T* value, Deleter deleter = {}) {
+        epoch::Retire(value, std::move(deleter));
+    }
+};
@@ -1,29 +1,91 @@
 #include "hazard_ptr.h"
-#include <mutex>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace {
+
+void OrphanRest() {
+    if (retired.ptrs.empty()) {
+        return;
+    }
+    auto* batch = new RetiredBatch{std::exchange(retired.ptrs, {}), orphans.load()};
+    while (!orphans.compare_exchange_weak(batch->next, batch)) {
+    }
+}
+
+}  // namespace
 
 void RegisterThread() {
-    ThreadState* state_ptr = new ThreadState{&hazard_ptr};
-    std::lock_guard lock(threads_lock);
-    threads.emplace(state_ptr);
+    ++num_active_threads;
+    for (auto* state = threads.load(); state; state = state->next) {
+        auto expected = false;
+        if (!state->active.load(std::memory_order_relaxed) &&
+            state->active.compare_exchange_strong(expected, true)) {
+            thread_state = state;
+            return;
+        }
+    }
+
+    auto* state = new ThreadState;
+    state->active.store(true, std::memory_order_relaxed);
+    state->next = threads.load();
+    while (!threads.compare_exchange_weak(state->next, state)) {
+    }
+    ++num_thread_states;
+    thread_state = state;
 }
 
 void UnregisterThread() {
-    size_t threads_size;
-    {
-        std::lock_guard lock(threads_lock);
-        for (auto it = threads.begin(); it != threads.end(); ++it) {
-            auto* state_ptr = *it;
-            if (state_ptr->ptr == &hazard_ptr) {
-                it = threads.erase(it);
-                delete state_ptr;
-                break;
+    for (auto& hazard : thread_state->hazards) {
+        hazard.store(nullptr);
+    }
+    Scan();
+    OrphanRest();
+    thread_state->active.store(false);
+    thread_state = &unregistered_thread_state;
+
+    // The last thread out frees what the others had to leave behind.
+    if (num_active_threads.fetch_sub(1) == 1) {
+        Scan();
+        OrphanRest();
+    }
+}
+
+void Scan() {
+    for (auto* batch = orphans.exchange(nullptr); batch;) {
+        retired.ptrs.insert(retired.ptrs.end(), batch->retired.begin(), batch->retired.end());
+        delete std::exchange(batch, batch->next);
+    }
+
+    // Hazards are read after the retired pointers are collected: a pointer that is already
+    // retired can no longer be acquired, so a hazard missing here cannot appear later.
+    std::vector<void*> hazards;
+    for (auto* state = threads.load(); state; state = state->next) {
+        for (auto& hazard : state->hazards) {
+            if (auto* ptr = hazard.load()) {
+                hazards.push_back(ptr);
             }
         }
+    }
+    std::ranges::sort(hazards);
 
-        threads_size = threads.size();
+    auto& ptrs = retired.ptrs;
+    auto free = std::ranges::partition(ptrs, [&](const RetiredPtr& ptr) {
+        return std::ranges::binary_search(hazards, ptr.value);
+    });
+    // Deleters may retire more pointers, so they run after the list is trimmed.
+    std::vector<RetiredPtr> to_free(free.begin(), free.end());
+    ptrs.erase(free.begin(), free.end());
+    for (auto& ptr : to_free) {
+        ptr.Free();
     }
+}
 
-    if (threads_size == 0) {
-        ScanFreeList();
+RetiredList::~RetiredList() {
+    if (!ptrs.empty()) {
+        Scan();
+        OrphanRest();
     }
 }
@@ -1,31 +1,46 @@
 #pragma once
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <cstddef>
-#include <functional>
-#include <mutex>
 #include <memory>
-#include <unordered_set>
+#include <utility>
+#include <vector>
 
-inline thread_local std::atomic<void*> hazard_ptr(nullptr);
+#include "retired_ptr.h"
 
+// Number of pointers a thread can protect at once, e.g. the previous and the current node of a
+// list traversal.
+constexpr size_t kHazardSlots = 4;
+
+// One record per thread that ever registered. Records are never freed: UnregisterThread marks
+// its record inactive and the next RegisterThread reuses it, so the registry is a list that
+// only grows at the head and can be walked without locks.
 struct ThreadState {
-    std::atomic<void*>* ptr;
+    std::array<std::atomic<void*>, kHazardSlots> hazards{};
+    std::atomic<bool> active = false;
+    ThreadState* next = nullptr;
 };
 
-inline std::mutex threads_lock;
-inline std::unordered_set<ThreadState*> threads;
+inline std::atomic<ThreadState*> threads = nullptr;
+inline std::atomic_size_t num_thread_states = 0;
+inline std::atomic_size_t num_active_threads = 0;
+// Threads that never registered write their hazards here. It is not in the registry, so, as
+// before, their hazards protect nothing.
+inline ThreadState unregistered_thread_state;
+inline thread_local ThreadState* thread_state = &unregistered_thread_state;
 
 void RegisterThread();
 void UnregisterThread();
 
 template <class T>
-inline T* Acquire(std::atomic<T*>* ptr) {
+inline T* Acquire(std::atomic<T*>* ptr, size_t slot = 0) {
+    auto& hazard = thread_state->hazards[slot];
     auto* value = ptr->load();
 
     do {
-        hazard_ptr.store(value);
+        hazard.store(value);
 
         auto* new_value = ptr->load();
         if (new_value == value) {
@@ -36,68 +51,63 @@ inline T* Acquire(std::atomic<T*>* ptr) {
     } while (true);
 }
 
-inline void Release() {
-    hazard_ptr.store(nullptr);
+// A release store is enough: reads of the protected object happen before a scan sees the
+// slot clear, and a scan that misses the clear only delays the free.
+inline void Release(size_t slot = 0) {
+    thread_state->hazards[slot].store(nullptr, std::memory_order_release);
 }
 
-struct RetiredPtr {
-    void* value;
-    std::function<void()> deleter;
-    RetiredPtr* next;
+// Retired pointers left over by threads that unregistered, adopted by the next scan.
+struct RetiredBatch {
+    std::vector<RetiredPtr> retired;
+    RetiredBatch* next;
 };
 
-inline std::atomic<RetiredPtr*> free_list = nullptr;
-inline std::atomic_size_t approximate_free_list_size = 0;
-constexpr size_t kFreeListMaxSize = 15;
+// A thread that exits without UnregisterThread still frees or hands off what it retired.
+struct RetiredList {
+    std::vector<RetiredPtr> ptrs;
 
-inline std::mutex scan_lock;
+    ~RetiredList();
+};
 
-inline void ScanFreeList() {
-    approximate_free_list_size.store(0);
+inline thread_local RetiredList retired;
+inline std::atomic<RetiredBatch*> orphans = nullptr;
 
-    if (!scan_lock.try_lock()) {
-        return;
-    }
+constexpr size_t kMinRetiredToScan = 16;
 
-    std::lock_guard lock(scan_lock, std::adopt_lock);
-    auto* retired = free_list.exchange(nullptr);
-    std::vector<void*> hazard;
-    {
-        std::lock_guard guard{threads_lock};
-        for (auto* thread : threads) {
-            if (auto* ptr = thread->ptr->load()) {
-                hazard.push_back(ptr);
-            }
-        }
-    }
+// Takes the orphans, frees every retired pointer of this thread that no hazard slot holds.
+void Scan();
 
-    std::sort(hazard.begin(), hazard.end());
-
-    while (retired) {
-        auto* node = retired;
-        retired = retired->next;
-        if (!std::binary_search(hazard.begin(), hazard.end(), node->value)) {
-            node->deleter();
-            delete node;
-        } else {
-            node->next = free_list.load();
-            while (!free_list.compare_exchange_weak(node->next, node)) {
-            }
-        }
-    }
+// A scan reads every hazard slot, so it runs once the retired list is twice that size: each
+// scan then frees at least half of the list and the cost per Retire stays constant.
+inline size_t ScanThreshold() {
+    return std::max(kMinRetiredToScan,
+                    2 * kHazardSlots * num_thread_states.load(std::memory_order_relaxed));
 }
 
 template <class T, class Deleter = std::default_delete<T>>
 inline void Retire(T* value, Deleter deleter = {}) {
-    RetiredPtr* retired_ptr =
-        new RetiredPtr{value, [deleter, value]() { deleter(value); }, free_list.load()};
+    retired.ptrs.emplace_back(value, std::move(deleter));
 
-    while (!free_list.compare_exchange_weak(retired_ptr->next, retired_ptr)) {
+    if (retired.ptrs.size() >= ScanThreshold()) {
+        Scan();
     }
+}
 
-    approximate_free_list_size.fetch_add(1);
+// Reclamation policy for the lock-free containers. EpochReclamation from epoch.h takes the same
+// calls, so a container can be built against either.
+struct HazardPointers {
+    template <class T>
+    static T* Acquire(std::atomic<T*>* ptr, size_t slot = 0) {
+        return ::Acquire(ptr, slot);
+    }
 
-    if (approximate_free_list_size > kFreeListMaxSize) {
-        ScanFreeList();
+    static void Release(size_t slot = 0) {
+        ::Release(slot);
     }
-}
+
+    template <class T, class Deleter = std::default_delete<T>>
+    static void Retire(T* value, Deleter deleter = {}) {
+        ::Retire(value, std::move(deleter));
+    }
+};
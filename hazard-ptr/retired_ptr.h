@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// A retired pointer with its deleter, shared by both reclamation schemes. Deleters that are
+// trivially copyable and fit in two pointers are kept inline, so retiring them allocates nothing
+// beyond the amortized growth of the retired list. Larger ones are moved to the heap. Either way
+// the record is trivially copyable and is freed exactly once, by Free.
+class RetiredPtr {
+public:
+    template <class T, class Deleter>
+    RetiredPtr(T* value, Deleter&& deleter) : value{value} {
+        using D = std::decay_t<Deleter>;
+        if constexpr (kInline<D>) {
+            new (storage_) D(std::forward<Deleter>(deleter));
+            free_ = [](void* value, std::byte* storage) {
+                (*std::launder(reinterpret_cast<D*>(storage)))(static_cast<T*>(value));
+            };
+        } else {
+            new (storage_) D*(new D(std::forward<Deleter>(deleter)));
+            free_ = [](void* value, std::byte* storage) {
+                D* deleter = *std::launder(reinterpret_cast<D**>(storage));
+                (*deleter)(static_cast<T*>(value));
+                delete deleter;
+            };
+        }
+    }
+
+    void Free() {
+        free_(value, storage_);
+    }
+
+    void* value;
+
+private:
+    static constexpr size_t kStorageSize = 2 * sizeof(void*);
+
+    template <class D>
+    static constexpr bool kInline = std::is_trivially_copyable_v<D> &&
+                                    sizeof(D) <= kStorageSize && alignof(D) <= alignof(void*);
+
+    void (*free_)(void*, std::byte*);
+    alignas(void*) std::byte storage_[kStorageSize];
+};
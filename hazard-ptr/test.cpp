@@ -1,5 +1,7 @@
 #include "hazard_ptr.h"
+#include "epoch.h"
 
+#include <array>
 #include <vector>
 #include <atomic>
 #include <mutex>
@@ -53,6 +55,30 @@ void Run(std::atomic<State*>* value) {
     UnregisterThread();
 }
 
+void RunEpoch(std::atomic<State*>* value) {
+    static std::mutex mutex;
+    static auto x = 0;
+
+    auto last_read = 0;
+    for (auto i = 0; i < 100'000; ++i) {
+        if (i % 123 == 0) {
+            State* old_value;
+            {
+                std::lock_guard guard{mutex};
+                old_value = value->exchange(new State{++x});
+            }
+            epoch::Retire(old_value);
+        } else {
+            epoch::CriticalGuard guard;
+            if (auto* p = value->load()) {
+                CHECK(p->value >= last_read);
+                last_read = p->value;
+            }
+        }
+    }
+    epoch::Retire(value->exchange(nullptr));
+}
+
 }  // namespace
 
 TEST_CASE("SingleThread") {
@@ -73,6 +99,27 @@ TEST_CASE("SingleThread") {
     UnregisterThread();
 }
 
+TEST_CASE("MultipleSlots") {
+    RegisterThread();
+
+    std::atomic first = new State{1};
+    std::atomic second = new State{2};
+    auto* p = Acquire(&first, 0);
+    auto* q = Acquire(&second, kHazardSlots - 1);
+    Retire(first.exchange(nullptr));
+    Retire(second.exchange(nullptr));
+    for (auto i = 0; i < 1'000; ++i) {
+        Retire(new State{i});
+    }
+    REQUIRE(p->value == 1);
+    REQUIRE(q->value == 2);
+
+    Release(0);
+    Release(kHazardSlots - 1);
+    UnregisterThread();
+    REQUIRE(State::num == 0);
+}
+
 TEST_CASE("ManyThreads") {
     for (auto i = 0; i < 5; ++i) {
         std::atomic<State*> value = nullptr;
@@ -84,3 +131,65 @@ TEST_CASE("ManyThreads") {
         REQUIRE(State::num == 0);
     }
 }
+
+TEST_CASE("EpochSingleThread") {
+    std::atomic value = new State{42};
+    {
+        epoch::CriticalGuard guard;
+        auto* p = value.load();
+        for (auto i = 0; i < 1'000; ++i) {
+            epoch::Retire(value.exchange(new State{i}));
+        }
+        REQUIRE(p->value == 42);
+    }
+    epoch::Retire(value.exchange(nullptr));
+    epoch::Flush();
+    REQUIRE(State::num == 0);
+}
+
+TEST_CASE("EpochManyThreads") {
+    for (auto i = 0; i < 5; ++i) {
+        std::atomic<State*> value = nullptr;
+        std::vector<std::jthread> threads;
+        for (auto i = 0; i < 10; ++i) {
+            threads.emplace_back(RunEpoch, &value);
+        }
+        threads.clear();
+        epoch::Flush();
+        REQUIRE(State::num == 0);
+    }
+}
+
+namespace {
+
+// Small deleters are stored in the retired record, the big one goes to the heap.
+template <size_t kPadding>
+struct CountingDeleter {
+    void operator()(State* value) const {
+        delete value;
+        ++*freed;
+    }
+
+    int* freed;
+    std::array<char, kPadding> padding{};
+};
+
+}  // namespace
+
+TEST_CASE("StatefulDeleters") {
+    int freed = 0;
+    Retire(new State{1}, CountingDeleter<1>{&freed});
+    Retire(new State{2}, CountingDeleter<64>{&freed});
+    Retire(new State{3}, [&freed, expected = std::vector{3}](State* value) {
+        freed += value->value == expected[0];
+        delete value;
+    });
+    Scan();
+    REQUIRE(freed == 3);
+
+    epoch::Retire(new State{1}, CountingDeleter<1>{&freed});
+    epoch::Retire(new State{2}, CountingDeleter<64>{&freed});
+    epoch::Flush();
+    REQUIRE(freed == 5);
+    REQUIRE(State::num == 0);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+// Lock-free list of nodes that are safe to reuse, linked through their atomic next field. Nodes
+// on the list are freed only by the destructor, so Take may read next of a node that another
+// thread has just taken: the counter in the upper bits of top_ changes on every update, and the
+// CAS fails.
+template <class Node>
+class TaggedFreeList {
+public:
+    TaggedFreeList() = default;
+    TaggedFreeList(const TaggedFreeList&) = delete;
+    TaggedFreeList& operator=(const TaggedFreeList&) = delete;
+
+    ~TaggedFreeList() {
+        for (Node* node = Untag(top_.load()); node;) {
+            delete std::exchange(node, Next(node));
+        }
+    }
+
+    // Returns nullptr once the list is empty.
+    Node* Take() {
+        auto top = top_.load(std::memory_order_acquire);
+        while (Node* node = Untag(top)) {
+            if (top_.compare_exchange_weak(top, Retag(Next(node), top),
+                                           std::memory_order_acquire)) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    // A single attempt, wait-free. Returns nullptr on contention as well.
+    Node* TryTake() {
+        auto top = top_.load(std::memory_order_acquire);
+        Node* node = Untag(top);
+        if (!node || !top_.compare_exchange_strong(top, Retag(Next(node), top),
+                                                   std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return node;
+    }
+
+    void Put(Node* node) {
+        if (!Fits(node)) {
+            delete node;
+            return;
+        }
+        auto top = top_.load(std::memory_order_relaxed);
+        do {
+            node->next.store(Untag(top), std::memory_order_relaxed);
+        } while (!top_.compare_exchange_weak(top, Retag(node, top), std::memory_order_release,
+                                             std::memory_order_relaxed));
+    }
+
+private:
+    static constexpr int kTagShift = 48;
+    static constexpr uintptr_t kPointerMask = (uintptr_t{1} << kTagShift) - 1;
+
+    static_assert(sizeof(uintptr_t) == 8);
+
+    // With 5-level paging an address may reach into the tag. Such a node is freed instead of
+    // reused, as top_ cannot hold it.
+    static bool Fits(Node* node) {
+        return !(reinterpret_cast<uintptr_t>(node) & ~kPointerMask);
+    }
+
+    // next may be declared in a base of Node.
+    static Node* Next(Node* node) {
+        return static_cast<Node*>(node->next.load(std::memory_order_relaxed));
+    }
+
+    static Node* Untag(uintptr_t top) {
+        return reinterpret_cast<Node*>(top & kPointerMask);
+    }
+
+    static uintptr_t Retag(Node* node, uintptr_t old_top) {
+        return reinterpret_cast<uintptr_t>(node) |
+               ((old_top & ~kPointerMask) + (uintptr_t{1} << kTagShift));
+    }
+
+    std::atomic<uintptr_t> top_ = 0;
+};
@@ -1,9 +1,11 @@
 #include "../hazard-ptr/hazard_ptr.h"
+#include "../hazard-ptr/epoch.h"
 #include "stack.h"
 #include "runner.h"
 
 #include <array>
 #include <utility>
+#include <vector>
 
 #include <catch2/catch_test_macros.hpp>
 
@@ -19,8 +21,9 @@ TEST_CASE("Stress Push") {
     REQUIRE(runner.Wait() < 100ns);
 }
 
+template <class Reclaimer>
 static void StressPushPop(uint32_t num_push_threads, uint32_t num_pop_threads) {
-    Stack<int> stack;
+    Stack<int, Reclaimer> stack;
 
     TimeRunner push_runner{1s};
     for (auto i = 0u; i < num_push_threads; ++i) {
@@ -40,9 +43,71 @@ static void StressPushPop(uint32_t num_push_threads, uint32_t num_pop_threads) {
     CHECK(pop_runner.Wait() < 15us);
 }
 
+// Every thread pushes and pops in turn, so failed CAS attempts find partners in the elimination
+// array.
+static void StressMixed(uint32_t num_threads) {
+    Stack<int> stack;
+    TimeRunner runner{1s};
+    for (auto i = 0u; i < num_threads; ++i) {
+        auto func = [&, value = 0]() mutable {
+            stack.Push(value);
+            stack.Pop(&value);
+        };
+        TaskWithExit task{std::move(func), UnregisterThread};
+        runner.DoWithInit(RegisterThread, std::move(task));
+    }
+    INFO(std::to_string(num_threads));
+    CHECK(runner.Wait() < 400ns);
+}
+
+static void StressBatches(uint32_t num_push_threads, uint32_t num_pop_threads) {
+    static constexpr auto kBatchSize = 16;
+    Stack<int> stack;
+
+    TimeRunner push_runner{1s};
+    for (auto i = 0u; i < num_push_threads; ++i) {
+        auto func = [&, batch = std::vector<int>(kBatchSize)] { stack.PushBatch(batch); };
+        TaskWithExit task{std::move(func), UnregisterThread};
+        push_runner.DoWithInit(RegisterThread, std::move(task));
+    }
+
+    TimeRunner pop_runner{1s};
+    for (auto i = 0u; i < num_pop_threads; ++i) {
+        auto func = [&, values = std::vector<int>{}]() mutable {
+            values.clear();
+            stack.PopAll(std::back_inserter(values));
+        };
+        TaskWithExit task{std::move(func), UnregisterThread};
+        pop_runner.DoWithInit(RegisterThread, std::move(task));
+    }
+
+    INFO(std::to_string(num_push_threads) + ' ' + std::to_string(num_pop_threads));
+    CHECK(push_runner.Wait() < kBatchSize * 200ns);
+    CHECK(pop_runner.Wait() < 15us);
+}
+
 TEST_CASE("Stress Push and Pop") {
     std::vector<std::pair<uint32_t, uint32_t>> tests = {{42, 8}, {75, 5}, {15, 5}, {50, 10}};
     for (auto [num_push_threads, num_pop_threads] : tests) {
-        StressPushPop(num_push_threads, num_pop_threads);
+        StressPushPop<HazardPointers>(num_push_threads, num_pop_threads);
+    }
+}
+
+TEST_CASE("Stress Push and Pop epoch") {
+    std::vector<std::pair<uint32_t, uint32_t>> tests = {{42, 8}, {75, 5}, {15, 5}, {50, 10}};
+    for (auto [num_push_threads, num_pop_threads] : tests) {
+        StressPushPop<EpochReclamation>(num_push_threads, num_pop_threads);
+    }
+}
+
+TEST_CASE("Stress Mixed") {
+    for (auto num_threads : {8, 16, 32}) {
+        StressMixed(num_threads);
+    }
+}
+
+TEST_CASE("Stress Batches") {
+    for (auto num_threads : {4, 8, 16}) {
+        StressBatches(num_threads, num_threads);
     }
 }
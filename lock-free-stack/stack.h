@@ -1,49 +1,99 @@
 #pragma once
 
 #include "../hazard-ptr/hazard_ptr.h"
+#include "free_list.h"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <utility>
 
-template <class T>
+// Reclaimer is HazardPointers or EpochReclamation from ../hazard-ptr/epoch.h.
+template <class T, class Reclaimer = HazardPointers>
 class Stack {
 public:
     void Push(const T& value) {
-        Node* old_head = head_;
-        Node* new_head = new Node{value, old_head};
+        Node* new_head = NewNode(value);
+        Node* old_head = head_.load();
+        new_head->next.store(old_head, std::memory_order_relaxed);
+        Backoff backoff;
         while (!head_.compare_exchange_weak(old_head, new_head)) {
-            new_head->next = old_head;
+            if (TryEliminatePush(new_head)) {
+                return;
+            }
+            backoff();
+            new_head->next.store(old_head, std::memory_order_relaxed);
         }
     }
 
     bool Pop(T* value) {
-        Node* old_head = Acquire(&head_);
+        Node* old_head = Reclaimer::Acquire(&head_);
+        Backoff backoff;
+        while (old_head && !head_.compare_exchange_weak(old_head, old_head->next.load())) {
+            if (TryEliminatePop(value)) {
+                Reclaimer::Release();
+                return true;
+            }
+            backoff();
+            old_head = Reclaimer::Acquire(&head_);
+        }
         if (!old_head) {
+            Reclaimer::Release();
             return false;
         }
 
-        while (!head_.compare_exchange_weak(old_head, old_head->next)) {
-            old_head = Acquire(&head_);
-            if (!old_head) {
-                return false;
-            }
+        *value = std::move(*old_head->value);
+        Reclaimer::Release();
+        Reclaimer::Retire(old_head, Recycle{});
+        return true;
+    }
+
+    // Links the values into a chain first and splices it in with one CAS. The last value ends up
+    // on top, as if they were pushed one by one.
+    void PushBatch(std::span<const T> values) {
+        if (values.empty()) {
+            return;
+        }
+        Node* bottom = NewNode(values.front());
+        Node* top = bottom;
+        for (const auto& value : values.subspan(1)) {
+            Node* node = NewNode(value);
+            node->next.store(top, std::memory_order_relaxed);
+            top = node;
         }
 
-        *value = std::move(old_head->value);
-        Release();
-        Retire(old_head);
-        return true;
+        Node* old_head = head_.load();
+        bottom->next.store(old_head, std::memory_order_relaxed);
+        Backoff backoff;
+        while (!head_.compare_exchange_weak(old_head, top)) {
+            backoff();
+            bottom->next.store(old_head, std::memory_order_relaxed);
+        }
     }
 
-    void Clear() {
-        Node* old_head = head_;
-        while (!head_.compare_exchange_weak(old_head, nullptr)) {
-            old_head = head_;
+    // Takes the whole stack with one exchange and writes its values to out, top first. Returns
+    // the number of values.
+    template <class OutputIt>
+    size_t PopAll(OutputIt out) {
+        size_t count = 0;
+        for (Node* node = head_.exchange(nullptr); node; ++count) {
+            *out = std::move(*node->value);
+            ++out;
+            Reclaimer::Retire(std::exchange(node, node->next.load()), Recycle{});
         }
+        return count;
+    }
 
-        while (old_head) {
-            Node* node = old_head;
-            old_head = old_head->next;
-            Retire(node);
+    void Clear() {
+        for (Node* node = head_.exchange(nullptr); node;) {
+            Reclaimer::Retire(std::exchange(node, node->next.load()), Recycle{});
         }
     }
 
@@ -53,9 +103,101 @@ public:
 
 private:
     struct Node {
-        T value;
-        Node* next;
+        std::optional<T> value;
+        std::atomic<Node*> next = nullptr;
+    };
+
+    // Nodes that are safe to reuse, so that push and pop in a steady state never allocate.
+    // Shared by all stacks of the same type, because a node may be reclaimed after its stack is
+    // gone.
+    static inline TaggedFreeList<Node> free_nodes_;
+
+    // Deleter for Retire: once no reader can hold the node, it goes back to the free list.
+    struct Recycle {
+        void operator()(Node* node) const {
+            node->value.reset();
+            free_nodes_.Put(node);
+        }
+    };
+
+    static Node* NewNode(const T& value) {
+        Node* node = free_nodes_.Take();
+        if (!node) {
+            node = new Node;
+        }
+        node->value.emplace(value);
+        return node;
+    }
+
+    // Between failed CAS attempts on head_ a thread yields 1, 2, 4, ... times, up to the limit.
+    class Backoff {
+    public:
+        void operator()() {
+            for (auto i = 0; i < yields_; ++i) {
+                std::this_thread::yield();
+            }
+            yields_ = std::min(2 * yields_, kMaxBackoffYields);
+        }
+
+    private:
+        int yields_ = 1;
     };
 
+    static constexpr auto kMaxBackoffYields = 16;
+
+    // Elimination array: a Push that lost the race on head_ offers its node in a random slot for
+    // a short while, and a Pop that lost the race takes a node offered there. Such a pair cancels
+    // out without touching head_. A slot holds nullptr, an offered node or kTaken. Nodes are only
+    // dereferenced by the thread whose CAS took them, so they are recycled right away.
+    static constexpr size_t kEliminationSlots = 8;
+    static constexpr auto kEliminationWait = 4;
+    static constexpr uintptr_t kTaken = 1;
+
+    struct alignas(64) EliminationSlot {
+        std::atomic<uintptr_t> node = 0;
+    };
+
+    static size_t RandomSlot() {
+        thread_local auto state =
+            static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1;
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state % kEliminationSlots;
+    }
+
+    bool TryEliminatePush(Node* node) {
+        auto& slot = elimination_[RandomSlot()].node;
+        const auto offer = reinterpret_cast<uintptr_t>(node);
+        uintptr_t empty = 0;
+        if (!slot.compare_exchange_strong(empty, offer, std::memory_order_release)) {
+            return false;
+        }
+        for (auto i = 0; i < kEliminationWait && slot.load() == offer; ++i) {
+            std::this_thread::yield();
+        }
+        // Withdrawing fails only if a Pop has taken the node, then the slot is freed here.
+        auto expected = offer;
+        if (slot.compare_exchange_strong(expected, 0)) {
+            return false;
+        }
+        slot.store(0);
+        return true;
+    }
+
+    bool TryEliminatePop(T* value) {
+        auto& slot = elimination_[RandomSlot()].node;
+        auto offer = slot.load(std::memory_order_relaxed);
+        if (offer == 0 || offer == kTaken ||
+            !slot.compare_exchange_strong(offer, kTaken, std::memory_order_acquire)) {
+            return false;
+        }
+        auto* node = reinterpret_cast<Node*>(offer);
+        *value = std::move(*node->value);
+        Recycle{}(node);
+        return true;
+    }
+
     std::atomic<Node*> head_ = nullptr;
+    std::array<EliminationSlot, kEliminationSlots> elimination_;
 };
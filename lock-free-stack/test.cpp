@@ -1,13 +1,17 @@
 #include "../hazard-ptr/hazard_ptr.h"
+#include "../hazard-ptr/epoch.h"
 #include "stack.h"
 
 #include <thread>
 #include <vector>
 #include <string>
 #include <atomic>
+#include <memory>
 #include <ranges>
 #include <random>
 #include <algorithm>
+#include <iterator>
+#include <numeric>
 
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_vector.hpp>
@@ -58,6 +62,47 @@ TEST_CASE("Clear") {
     UnregisterThread();
 }
 
+TEST_CASE("Recycling") {
+    RegisterThread();
+
+    auto value = std::make_shared<int>(42);
+    Stack<std::shared_ptr<int>> s;
+    for (auto i = 0; i < 1'000; ++i) {
+        s.Push(value);
+        s.Push(value);
+        std::shared_ptr<int> popped;
+        REQUIRE(s.Pop(&popped));
+        REQUIRE(popped == value);
+    }
+    s.Clear();
+
+    // Reclaimed nodes destroy their values before they are reused.
+    UnregisterThread();
+    CHECK(value.use_count() == 1);
+}
+
+TEST_CASE("Batches") {
+    RegisterThread();
+
+    Stack<int> s;
+    s.PushBatch(std::vector{0, 1, 2});
+    s.Push(3);
+    s.PushBatch(std::vector<int>{});
+    s.PushBatch(std::vector{4, 5});
+
+    int value{};
+    REQUIRE(s.Pop(&value));
+    REQUIRE(value == 5);
+
+    std::vector<int> all;
+    REQUIRE(s.PopAll(std::back_inserter(all)) == 5);
+    CHECK(all == std::vector{4, 3, 2, 1, 0});
+    CHECK(s.PopAll(std::back_inserter(all)) == 0);
+    CHECK_FALSE(s.Pop(&value));
+
+    UnregisterThread();
+}
+
 TEST_CASE("Pushes") {
     static constexpr auto kNumThreads = 16;
     static constexpr auto kRange = std::views::iota(0, kNumThreads);
@@ -133,7 +178,8 @@ std::vector<T> Merge(const std::vector<std::vector<T>>& data) {
     return {joined.begin(), joined.end()};
 }
 
-TEST_CASE("PushPop") {
+template <class Reclaimer>
+void RunPushPop() {
     static constexpr auto kNumPushThreads = 6;
     static constexpr auto kNumPopThreads = 2;
     static constexpr auto kNumIterations = 10'000;
@@ -141,7 +187,7 @@ TEST_CASE("PushPop") {
 
     std::vector<std::vector<std::string>> pushed(kNumPushThreads);
     std::vector<std::jthread> threads;
-    Stack<std::string> stack;
+    Stack<std::string, Reclaimer> stack;
     std::atomic push_finished = 0;
 
     for (auto i = 0; i < kNumPushThreads; ++i) {
@@ -191,3 +237,58 @@ TEST_CASE("PushPop") {
 
     UnregisterThread();
 }
+
+TEST_CASE("PushPop") {
+    RunPushPop<HazardPointers>();
+}
+
+TEST_CASE("PushPop epoch") {
+    RunPushPop<EpochReclamation>();
+}
+
+TEST_CASE("PushBatchPopAll") {
+    static constexpr auto kNumPushThreads = 8;
+    static constexpr auto kNumPopThreads = 8;
+    static constexpr auto kNumBatches = 2'000;
+    static constexpr auto kBatchSize = 8;
+    static constexpr auto kN = kNumPushThreads * kNumBatches * kBatchSize;
+    RegisterThread();
+
+    Stack<int> stack;
+    std::atomic push_finished = 0;
+    std::vector<std::vector<int>> popped(kNumPopThreads + 1);
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumPushThreads; ++i) {
+        threads.emplace_back([&, i] {
+            RegisterThread();
+            std::vector<int> batch(kBatchSize);
+            for (auto j = 0; j < kNumBatches; ++j) {
+                std::iota(batch.begin(), batch.end(), (i * kNumBatches + j) * kBatchSize);
+                stack.PushBatch(batch);
+            }
+            ++push_finished;
+            UnregisterThread();
+        });
+    }
+    for (auto i = 0; i < kNumPopThreads; ++i) {
+        threads.emplace_back([&, &popped = popped[i], i] {
+            RegisterThread();
+            while (push_finished != kNumPushThreads) {
+                if (i % 2) {
+                    stack.PopAll(std::back_inserter(popped));
+                } else if (int value; stack.Pop(&value)) {
+                    popped.push_back(value);
+                }
+            }
+            UnregisterThread();
+        });
+    }
+    threads.clear();
+    stack.PopAll(std::back_inserter(popped.back()));
+
+    auto all_popped = Merge(popped);
+    std::ranges::sort(all_popped);
+    CHECK(std::ranges::equal(all_popped, std::views::iota(0, kN)));
+
+    UnregisterThread();
+}
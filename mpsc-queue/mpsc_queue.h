@@ -1,53 +1,118 @@
 #pragma once
 
+#include "../lock-free-stack/free_list.h"
+
 #include <atomic>
 #include <optional>
+#include <type_traits>
 #include <utility>
 
+// Base for nodes of IntrusiveMPSCQueue.
+struct MPSCQueueHook {
+    std::atomic<MPSCQueueHook*> next = nullptr;
+};
+
+// Vyukov's intrusive MPSC queue. Producers swap themselves into head_ and then link the previous
+// node to the new one, consumer walks from tail_ through a stub node that keeps the list
+// non-empty. Nodes are owned by the caller and must stay alive until they are popped.
+template <class Node>
+class IntrusiveMPSCQueue {
+public:
+    IntrusiveMPSCQueue() : head_(&stub_), tail_(&stub_) {
+    }
+
+    IntrusiveMPSCQueue(const IntrusiveMPSCQueue&) = delete;
+    IntrusiveMPSCQueue& operator=(const IntrusiveMPSCQueue&) = delete;
+
+    // Wait-free. Safe to call from multiple threads.
+    void Push(Node* node) {
+        PushHook(node);
+    }
+
+    // Returns the oldest node or nullptr. Also returns nullptr while the producer of the oldest
+    // node has not linked it yet. Not safe to call concurrently.
+    Node* Pop() {
+        auto* tail = tail_;
+        auto* next = tail->next.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next) {
+                return nullptr;
+            }
+            tail_ = tail = next;
+            next = next->next.load(std::memory_order_acquire);
+        }
+        if (next) {
+            tail_ = next;
+            return static_cast<Node*>(tail);
+        }
+
+        // tail is the last linked node. Put the stub after it, so that it can be handed out.
+        if (tail != head_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        PushHook(&stub_);
+        next = tail->next.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return static_cast<Node*>(tail);
+        }
+        return nullptr;
+    }
+
+private:
+    static_assert(std::is_base_of_v<MPSCQueueHook, Node>);
+
+    void PushHook(MPSCQueueHook* node) {
+        node->next.store(nullptr, std::memory_order_relaxed);
+        auto* prev = head_.exchange(node, std::memory_order_acq_rel);
+        prev->next.store(node, std::memory_order_release);
+    }
+
+    alignas(64) std::atomic<MPSCQueueHook*> head_;
+    alignas(64) MPSCQueueHook* tail_;
+    MPSCQueueHook stub_;
+};
+
 template <class T>
 class MPSCQueue {
 public:
-    // Push adds one element to stack top.
+    MPSCQueue() = default;
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // Push adds one element to the queue tail.
     // Safe to call from multiple threads.
     void Push(T value) {
-        Node* old_head = head_;
-        Node* new_head = new Node{std::move(value), old_head};
-        while (!head_.compare_exchange_weak(old_head, new_head)) {
-            old_head = head_;
-            new_head->next = old_head;
+        // A single attempt keeps Push wait-free: on contention the producer allocates instead.
+        auto* node = free_.TryTake();
+        if (!node) {
+            node = new Node;
         }
+        node->value.emplace(std::move(value));
+        queue_.Push(node);
     }
 
-    // Pop removes top element from the stack.
+    // Pop removes the oldest element from the queue.
+    // Returns std::nullopt if the queue is empty, but also while the producer of the oldest
+    // element is still linking it in, so std::nullopt does not prove the queue empty.
     // Not safe to call concurrently.
     std::optional<T> Pop() {
-        Node* old_head = head_;
-        if (!old_head) {
+        auto* node = queue_.Pop();
+        if (!node) {
             return std::nullopt;
         }
-
-        while (!head_.compare_exchange_weak(old_head, old_head->next)) {
-            old_head = head_;
-        }
-
-        std::optional<T> res = std::move(old_head->value);
-        delete old_head;
+        std::optional<T> res{std::move(*node->value)};
+        Recycle(node);
         return res;
     }
 
-    // DequeuedAll Pop's all elements from the stack and calls callback() for each.
+    // DequeueAll Pop's all elements in FIFO order and calls callback() for each.
+    // Like Pop, stops early at an element that is still being linked in.
     // Not safe to call concurrently with Pop()
     void DequeueAll(auto&& callback) {
-        Node* old_head = head_;
-        while (!head_.compare_exchange_weak(old_head, nullptr)) {
-            old_head = head_;
-        }
-
-        while (old_head) {
-            Node* node = old_head;
-            old_head = old_head->next;
-            callback(std::move(node->value));
-            delete node;
+        while (auto* node = queue_.Pop()) {
+            callback(std::move(*node->value));
+            Recycle(node);
         }
     }
 
@@ -56,10 +121,17 @@ public:
     }
 
 private:
-    struct Node {
-        T value;
-        Node* next;
+    struct Node : MPSCQueueHook {
+        std::optional<T> value;
     };
 
-    std::atomic<Node*> head_ = nullptr;
+    void Recycle(Node* node) {
+        node->value.reset();
+        free_.Put(node);
+    }
+
+    IntrusiveMPSCQueue<Node> queue_;
+    // Popped nodes go to a free list that producers take them from, so a queue of bounded
+    // length stops allocating.
+    alignas(64) TaggedFreeList<Node> free_;
 };
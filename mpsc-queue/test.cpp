@@ -7,6 +7,8 @@
 #include <tuple>
 #include <string>
 #include <memory>
+#include <utility>
+#include <vector>
 
 #include <catch2/catch_test_macros.hpp>
 #include <catch2/matchers/catch_matchers_range_equals.hpp>
@@ -19,10 +21,10 @@ TEST_CASE("PushPop") {
     queue.Push(2);
 
     auto x = queue.Pop();
-    REQUIRE(x == 2);
+    REQUIRE(x == 1);
 
     x = queue.Pop();
-    REQUIRE(x == 1);
+    REQUIRE(x == 2);
 
     x = queue.Pop();
     REQUIRE_FALSE(x.has_value());
@@ -37,7 +39,7 @@ TEST_CASE("SingleThread") {
 
     std::vector<int> dequeued;
     queue.DequeueAll([&](int value) { dequeued.push_back(value); });
-    REQUIRE_THAT(dequeued, RangeEquals(kRange | std::views::reverse));
+    REQUIRE_THAT(dequeued, RangeEquals(kRange));
 }
 
 TEST_CASE("Destructor") {
@@ -54,16 +56,16 @@ TEST_CASE("MoveOnly") {
 
     auto x = queue.Pop();
     REQUIRE(x.has_value());
-    REQUIRE(**x == "caba");
+    REQUIRE(**x == "aba");
 
     queue.Push(std::make_unique<std::string>("foo"));
     auto n = 0;
     auto check = [&](std::unique_ptr<std::string> s) {
         REQUIRE(n < 2);
         if (n == 0) {
-            REQUIRE(*s == "foo");
+            REQUIRE(*s == "caba");
         } else {
-            REQUIRE(*s == "aba");
+            REQUIRE(*s == "foo");
         }
         ++n;
     };
@@ -102,3 +104,58 @@ TEST_CASE("Threaded") {
     REQUIRE_THAT(dequeued | std::views::keys, RangeEquals(kRange));
     REQUIRE(std::ranges::count(dequeued | std::views::values, kNumProducers) == kN);
 }
+
+TEST_CASE("ProducerOrder") {
+    constexpr auto kN = 100'000;
+    constexpr auto kNumProducers = 4;
+
+    MPSCQueue<std::pair<int, int>> queue;
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumProducers; ++i) {
+        threads.emplace_back([&, i] {
+            for (auto x = 0; x < kN; ++x) {
+                queue.Push({i, x});
+            }
+        });
+    }
+
+    std::vector<int> next(kNumProducers);
+    auto in_order = true;
+    for (auto received = 0; received < kN * kNumProducers;) {
+        if (auto value = queue.Pop()) {
+            auto [producer, x] = *value;
+            in_order &= x == next[producer]++;
+            ++received;
+        } else {
+            std::this_thread::yield();
+        }
+    }
+    REQUIRE(in_order);
+    REQUIRE_FALSE(queue.Pop().has_value());
+}
+
+TEST_CASE("Intrusive") {
+    struct Message : MPSCQueueHook {
+        int value;
+    };
+
+    IntrusiveMPSCQueue<Message> queue;
+    REQUIRE(queue.Pop() == nullptr);
+
+    std::vector<Message> messages(10);
+    for (auto i = 0; i < 10; ++i) {
+        messages[i].value = i;
+        queue.Push(&messages[i]);
+    }
+    for (auto i = 0; i < 5; ++i) {
+        auto* message = queue.Pop();
+        REQUIRE(message == &messages[i]);
+        queue.Push(message);
+    }
+    for (auto i : {5, 6, 7, 8, 9, 0, 1, 2, 3, 4}) {
+        auto* message = queue.Pop();
+        REQUIRE(message);
+        REQUIRE(message->value == i);
+    }
+    REQUIRE(queue.Pop() == nullptr);
+}
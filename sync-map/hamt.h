@@ -0,0 +1,191 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Persistent hash array mapped trie in the CHAMP layout. Every level takes 5 bits of the hash,
+// a node keeps the entries stored at it and its subtrees in two arrays, each indexed by the
+// popcount of its own 32-bit bitmap. Set copies the path from the root to the changed entry and
+// shares everything else, so copying the map is O(1) and both copies stay valid. Readers may
+// walk a map concurrently as long as nobody modifies that copy.
+template <class K, class V, class Hash = std::hash<K>>
+class PersistentHashMap {
+public:
+    const V* Find(const K& key) const {
+        const auto hash = HashOf(key);
+        const Node* node = root_.get();
+        for (auto shift = 0; node; shift += kBits) {
+            if (shift >= kHashBits) {
+                for (const auto& entry : node->entries) {
+                    if (entry.key == key) {
+                        return &entry.value;
+                    }
+                }
+                return nullptr;
+            }
+
+            const uint32_t bit = 1u << ((hash >> shift) & kMask);
+            if (node->entry_map & bit) {
+                const auto& entry = node->entries[Index(node->entry_map, bit)];
+                return entry.hash == hash && entry.key == key ? &entry.value : nullptr;
+            }
+            if (!(node->child_map & bit)) {
+                return nullptr;
+            }
+            node = node->children[Index(node->child_map, bit)].get();
+        }
+        return nullptr;
+    }
+
+    bool Contains(const K& key) const {
+        return Find(key);
+    }
+
+    // Inserts or replaces the value. O(log n) new nodes, the old ones stay with other copies.
+    void Set(const K& key, const V& value) {
+        auto added = false;
+        root_ = Set(root_.get(), 0, Entry{HashOf(key), key, value}, &added);
+        size_ += added;
+    }
+
+    size_t Size() const {
+        return size_;
+    }
+
+    // Calls func(key, value) for every entry, in no particular order.
+    template <class Function>
+    void ForEach(Function&& func) const {
+        if (root_) {
+            ForEach(root_.get(), func);
+        }
+    }
+
+private:
+    static constexpr auto kBits = 5;
+    static constexpr uint64_t kMask = (1u << kBits) - 1;
+    static constexpr auto kHashBits = 64;
+
+    struct Entry {
+        uint64_t hash;
+        K key;
+        V value;
+    };
+
+    struct Node;
+    using NodePtr = std::shared_ptr<const Node>;
+
+    // Below the last level all hash bits are used up, and a node is a plain list of entries
+    // with equal hashes.
+    struct Node {
+        uint32_t entry_map = 0;
+        uint32_t child_map = 0;
+        std::vector<Entry> entries;
+        std::vector<NodePtr> children;
+    };
+
+    // The finalizer of MurmurHash3, so that identity hashes of integers spread over all levels.
+    static uint64_t HashOf(const K& key) {
+        uint64_t hash = Hash{}(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        hash *= 0xc4ceb9fe1a85ec53ull;
+        hash ^= hash >> 33;
+        return hash;
+    }
+
+    static int Index(uint32_t map, uint32_t bit) {
+        return std::popcount(map & (bit - 1));
+    }
+
+    static uint32_t Bit(uint64_t hash, int shift) {
+        return 1u << ((hash >> shift) & kMask);
+    }
+
+    template <class Function>
+    static void ForEach(const Node* node, Function& func) {
+        for (const auto& entry : node->entries) {
+            func(entry.key, entry.value);
+        }
+        for (const auto& child : node->children) {
+            ForEach(child.get(), func);
+        }
+    }
+
+    static NodePtr Set(const Node* node, int shift, Entry entry, bool* added) {
+        auto copy = node ? std::make_shared<Node>(*node) : std::make_shared<Node>();
+        auto& entries = copy->entries;
+        if (shift >= kHashBits) {
+            for (auto& old : entries) {
+                if (old.key == entry.key) {
+                    old = std::move(entry);
+                    return copy;
+                }
+            }
+            entries.push_back(std::move(entry));
+            *added = true;
+            return copy;
+        }
+
+        const auto bit = Bit(entry.hash, shift);
+        if (copy->child_map & bit) {
+            auto& child = copy->children[Index(copy->child_map, bit)];
+            child = Set(child.get(), shift + kBits, std::move(entry), added);
+            return copy;
+        }
+
+        const auto index = Index(copy->entry_map, bit);
+        if (!(copy->entry_map & bit)) {
+            copy->entry_map |= bit;
+            entries.insert(entries.begin() + index, std::move(entry));
+            *added = true;
+            return copy;
+        }
+        if (auto& old = entries[index]; old.hash == entry.hash && old.key == entry.key) {
+            old = std::move(entry);
+            return copy;
+        }
+
+        // Two entries in one slot: both move one level down.
+        auto child = Pair(std::move(entries[index]), std::move(entry), shift + kBits);
+        entries.erase(entries.begin() + index);
+        copy->entry_map ^= bit;
+        copy->child_map |= bit;
+        copy->children.insert(copy->children.begin() + Index(copy->child_map, bit),
+                              std::move(child));
+        *added = true;
+        return copy;
+    }
+
+    static NodePtr Pair(Entry first, Entry second, int shift) {
+        auto node = std::make_shared<Node>();
+        if (shift >= kHashBits) {
+            node->entries.push_back(std::move(first));
+            node->entries.push_back(std::move(second));
+            return node;
+        }
+
+        const auto first_bit = Bit(first.hash, shift);
+        const auto second_bit = Bit(second.hash, shift);
+        if (first_bit == second_bit) {
+            node->child_map = first_bit;
+            node->children.push_back(Pair(std::move(first), std::move(second), shift + kBits));
+            return node;
+        }
+        node->entry_map = first_bit | second_bit;
+        if (first_bit > second_bit) {
+            std::swap(first, second);
+        }
+        node->entries.push_back(std::move(first));
+        node->entries.push_back(std::move(second));
+        return node;
+    }
+
+    NodePtr root_;
+    size_t size_ = 0;
+};
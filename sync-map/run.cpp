@@ -1,4 +1,5 @@
 #include "../hazard-ptr/hazard_ptr.h"
+#include "../hazard-ptr/epoch.h"
 #include "sync_map.h"
 #include "runner.h"
 
@@ -37,8 +38,9 @@ void RunSharedMutex(uint32_t num_threads) {
     CHECK_FALSE(is_error);
 }
 
+template <class Reclaimer>
 void RunSyncMap(uint32_t num_threads) {
-    SyncMap<int, int> map;
+    SyncMap<int, int, Reclaimer> map;
     for (auto i = 0; i < 1024; ++i) {
         map.Insert(i, i);
     }
@@ -58,6 +60,46 @@ void RunSyncMap(uint32_t num_threads) {
     CHECK_FALSE(is_error);
 }
 
+// Stores to keys of the read-only snapshot replace the value with a CAS, without the mutex.
+void RunStore(uint32_t num_threads) {
+    SyncMap<int, int> map;
+    for (auto i = 0; i < 1024; ++i) {
+        map.Insert(i, i);
+    }
+    TimeRunner runner{1s};
+    auto is_error = false;
+    for (auto i = 0u; i < num_threads; ++i) {
+        auto func = [&, i, is_error = std::atomic_ref{is_error}, v = 0]() mutable {
+            map.Store(i, ++v);
+            if (!map.Lookup(i, &v)) {
+                is_error.store(true, std::memory_order::relaxed);
+            }
+        };
+        TaskWithExit task{std::move(func), UnregisterThread};
+        runner.DoWithInit(RegisterThread, std::move(task));
+    }
+    INFO(std::to_string(num_threads));
+    CHECK(runner.Wait() < 200ns);
+    CHECK_FALSE(is_error);
+}
+
+// Every insert is followed by enough locked lookups to promote it into the read-only snapshot,
+// while the map keeps growing. A promotion that copies the whole table makes this quadratic.
+void RunInsertPromote() {
+    SyncMap<int, int> map;
+    TimeRunner runner{1s};
+    auto func = [&, key = 0, value = 0]() mutable {
+        map.Insert(key, key);
+        for (auto i = 0; i < 16; ++i) {
+            map.Lookup(key, &value);
+        }
+        ++key;
+    };
+    TaskWithExit task{std::move(func), UnregisterThread};
+    runner.DoWithInit(RegisterThread, std::move(task));
+    CHECK(runner.Wait() < 10us);
+}
+
 }  // namespace
 
 TEST_CASE("Shared mutex") {
@@ -68,6 +110,22 @@ TEST_CASE("Shared mutex") {
 
 TEST_CASE("Sync map") {
     for (auto num_threads : {4, 8, 16}) {
-        RunSyncMap(num_threads);
+        RunSyncMap<HazardPointers>(num_threads);
     }
 }
+
+TEST_CASE("Sync map epoch") {
+    for (auto num_threads : {4, 8, 16}) {
+        RunSyncMap<EpochReclamation>(num_threads);
+    }
+}
+
+TEST_CASE("Sync map store") {
+    for (auto num_threads : {4, 8, 16}) {
+        RunStore(num_threads);
+    }
+}
+
+TEST_CASE("Insert and promote") {
+    RunInsertPromote();
+}
@@ -1,58 +1,115 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 #include "../hazard-ptr/hazard_ptr.h"
+#include "hamt.h"
 
-template <class K, class V>
+// Reclaimer is HazardPointers or EpochReclamation from ../hazard-ptr/epoch.h.
+template <class K, class V, class Reclaimer = HazardPointers>
 class SyncMap {
 public:
     SyncMap();
     ~SyncMap();
     bool Lookup(const K& key, V* value);
+    // Inserts the key only if it is absent. Returns true if it was inserted.
     bool Insert(const K& key, const V& value);
+    // Inserts the key or replaces its value.
+    void Store(const K& key, const V& value);
+    // Returns true if the key was present.
+    bool Delete(const K& key);
+    // Returns true and loads the present value into actual, or stores value and returns false.
+    // actual may be null if the present value is not needed.
+    bool LoadOrStore(const K& key, const V& value, V* actual);
 
 private:
+    // Keys of the read-only snapshot map to entries, so that a present key is updated or
+    // deleted with a CAS on its entry, without the mutex. The value pointer of an entry is
+    // nullptr for a deleted key and Expunged() for a deleted key that a compaction has dropped
+    // from the current snapshot: such a key can only be stored again under the mutex.
+    struct Entry {
+        explicit Entry(V* value) : value(value) {
+        }
+        ~Entry() {
+            if (auto* ptr = value.load(); ptr != Expunged()) {
+                delete ptr;
+            }
+        }
+
+        std::atomic<V*> value;
+    };
+
+    // Snapshots share structure, so promoting the mutable map costs O(log n) per entry in it,
+    // not a copy of the whole table.
     struct Snapshot {
-        const std::shared_ptr<const std::unordered_map<K, V>> read_only;
+        const PersistentHashMap<K, std::shared_ptr<Entry>> read_only;
 
         // Indicates that read_only snapshot may be incomplete and lookup should take lock.
         const bool dirty;
     };
 
+    static V* Expunged() {
+        alignas(V) static char expunged;
+        return reinterpret_cast<V*>(&expunged);
+    }
+
+    static Entry* Find(const Snapshot* snapshot, const K& key) {
+        auto* entry = snapshot->read_only.Find(key);
+        return entry ? entry->get() : nullptr;
+    }
+
+    bool Load(Entry* entry, V* value);
+    bool TryStore(Entry* entry, const V& value);
+    bool TryLoadOrStore(Entry* entry, const V& value, V* actual, bool* loaded);
+    bool TryDelete(Entry* entry, bool* deleted);
+    void AddToMutableMap(Snapshot* old_snapshot, const K& key, const V& value);
+    void CountOperation(Snapshot* old_snapshot);
+    void Promote(Snapshot* old_snapshot);
+    bool NeedsCompaction(size_t snapshot_size) const;
+
     std::atomic<Snapshot*> snapshot_;
-    std::shared_ptr<std::unordered_map<K, V>> mutable_map_ = nullptr;
+    std::unordered_map<K, V> mutable_map_;
     size_t operation_count_ = 0;
+    // Deleted keys still in the snapshot. Signed: a Store may revive a key before its Delete
+    // has counted it.
+    std::atomic<ptrdiff_t> deleted_count_ = 0;
     std::mutex mutex_;
-    static constexpr size_t kMaxOperationsCnt = 15;
+    // Promotion costs O(log n) per key of the mutable map, so it waits for at least as many
+    // locked operations as there are keys to promote.
+    static constexpr size_t kMinOperationsCnt = 15;
+    // A compaction rebuilds the whole snapshot, so it waits until deleted keys are half of it.
+    static constexpr size_t kMinDeletedToCompact = 16;
 };
 
-template <class K, class V>
-SyncMap<K, V>::SyncMap() {
-    Snapshot* snapshot = new Snapshot{std::make_shared<const std::unordered_map<K, V>>(), false};
+template <class K, class V, class Reclaimer>
+SyncMap<K, V, Reclaimer>::SyncMap() {
+    Snapshot* snapshot = new Snapshot{{}, false};
     snapshot_.store(snapshot);
 }
 
-template <class K, class V>
-SyncMap<K, V>::~SyncMap() {
+template <class K, class V, class Reclaimer>
+SyncMap<K, V, Reclaimer>::~SyncMap() {
     delete snapshot_.load();
 }
 
-template <class K, class V>
-bool SyncMap<K, V>::Lookup(const K& key, V* value) {
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::Lookup(const K& key, V* value) {
     bool need_lock = true;
     bool found = false;
 
-    Snapshot* snapshot = Acquire(&snapshot_);
-    if (snapshot->read_only->contains(key)) {
-        *value = snapshot->read_only->at(key);
-        found = true;
-        need_lock = false;
+    Snapshot* snapshot = Reclaimer::Acquire(&snapshot_);
+    if (Entry* entry = Find(snapshot, key)) {
+        found = Load(entry, value);
+        // An expunged key may be in the mutable map or in a newer snapshot.
+        need_lock = !found && entry->value.load() == Expunged();
     } else if (!snapshot->dirty) {
         need_lock = false;
     }
-    Release();
+    Reclaimer::Release();
 
     if (!need_lock) {
         return found;
@@ -60,66 +117,253 @@ bool SyncMap<K, V>::Lookup(const K& key, V* value) {
 
     std::lock_guard lock(mutex_);
     Snapshot* old_snapshot = snapshot_.load();
-    if (old_snapshot->read_only->contains(key)) {
-        *value = old_snapshot->read_only->at(key);
-        return true;
+    if (Entry* entry = Find(old_snapshot, key)) {
+        return Load(entry, value);
     }
 
-    if (!mutable_map_) {
+    if (mutable_map_.empty()) {
         return false;
     }
 
-    if (mutable_map_->contains(key)) {
-        *value = mutable_map_->at(key);
+    if (auto it = mutable_map_.find(key); it != mutable_map_.end()) {
+        *value = it->second;
         found = true;
     }
-
-    if (++operation_count_ == kMaxOperationsCnt) {
-        mutable_map_->insert(old_snapshot->read_only->begin(), old_snapshot->read_only->end());
-        Snapshot* new_snapshot = new Snapshot{mutable_map_, false};
-        snapshot_.store(new_snapshot);
-        Retire(old_snapshot);
-        mutable_map_ = nullptr;
-        operation_count_ = 0;
-    };
-
+    CountOperation(old_snapshot);
     return found;
 }
 
-template <class K, class V>
-bool SyncMap<K, V>::Insert(const K& key, const V& value) {
-    bool need_lock = true;
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::Insert(const K& key, const V& value) {
+    return !LoadOrStore(key, value, nullptr);
+}
 
-    Snapshot* snapshot = Acquire(&snapshot_);
-    if (snapshot->read_only->contains(key)) {
-        need_lock = false;
+template <class K, class V, class Reclaimer>
+void SyncMap<K, V, Reclaimer>::Store(const K& key, const V& value) {
+    Snapshot* snapshot = Reclaimer::Acquire(&snapshot_);
+    Entry* entry = Find(snapshot, key);
+    const bool stored = entry && TryStore(entry, value);
+    Reclaimer::Release();
+    if (stored) {
+        return;
     }
-    Release();
 
-    if (!need_lock) {
-        return false;
+    std::lock_guard lock(mutex_);
+    Snapshot* old_snapshot = snapshot_.load();
+    // Entries of the current snapshot are never expunged, so TryStore succeeds here.
+    if (Entry* entry = Find(old_snapshot, key)) {
+        TryStore(entry, value);
+    } else if (auto it = mutable_map_.find(key); it != mutable_map_.end()) {
+        it->second = value;
+    } else {
+        AddToMutableMap(old_snapshot, key, value);
+    }
+}
+
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::Delete(const K& key) {
+    auto deleted = false;
+    Snapshot* snapshot = Reclaimer::Acquire(&snapshot_);
+    Entry* entry = Find(snapshot, key);
+    const bool done = entry ? TryDelete(entry, &deleted) : !snapshot->dirty;
+    const size_t snapshot_size = snapshot->read_only.Size();
+    Reclaimer::Release();
+
+    if (done) {
+        if (deleted) {
+            ++deleted_count_;
+            if (NeedsCompaction(snapshot_size)) {
+                std::lock_guard lock(mutex_);
+                Promote(snapshot_.load());
+            }
+        }
+        return deleted;
     }
 
     std::lock_guard lock(mutex_);
     Snapshot* old_snapshot = snapshot_.load();
-    if (old_snapshot->read_only->contains(key)) {
-        return false;
+    if (Entry* entry = Find(old_snapshot, key)) {
+        TryDelete(entry, &deleted);
+        deleted_count_ += deleted;
+        return deleted;
     }
-
-    if (!mutable_map_) {
-        mutable_map_ = std::make_shared<std::unordered_map<K, V>>();
-        mutable_map_->emplace(key, value);
-        Snapshot* new_snapshot = new Snapshot{old_snapshot->read_only, true};
+    deleted = mutable_map_.erase(key);
+    if (deleted && mutable_map_.empty()) {
+        // Nothing is left to promote, so misses may skip the mutex again.
+        Snapshot* new_snapshot = new Snapshot{old_snapshot->read_only, false};
         snapshot_.store(new_snapshot);
-        Retire(old_snapshot);
+        Reclaimer::Retire(old_snapshot);
+        operation_count_ = 0;
+        return deleted;
+    }
+    CountOperation(old_snapshot);
+    return deleted;
+}
+
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::LoadOrStore(const K& key, const V& value, V* actual) {
+    auto loaded = false;
+    Snapshot* snapshot = Reclaimer::Acquire(&snapshot_);
+    Entry* entry = Find(snapshot, key);
+    const bool done = entry && TryLoadOrStore(entry, value, actual, &loaded);
+    Reclaimer::Release();
+    if (done) {
+        return loaded;
+    }
+
+    std::lock_guard lock(mutex_);
+    Snapshot* old_snapshot = snapshot_.load();
+    if (Entry* entry = Find(old_snapshot, key)) {
+        TryLoadOrStore(entry, value, actual, &loaded);
+        return loaded;
+    }
+    if (auto it = mutable_map_.find(key); it != mutable_map_.end()) {
+        if (actual) {
+            *actual = it->second;
+        }
+        CountOperation(old_snapshot);
         return true;
+    }
+    AddToMutableMap(old_snapshot, key, value);
+    if (actual) {
+        *actual = value;
+    }
+    return false;
+}
+
+// Values are replaced by a CAS on the entry and retired, so they are read through the second
+// slot of the reclaimer. A null value only checks for presence and needs no protection.
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::Load(Entry* entry, V* value) {
+    if (!value) {
+        V* ptr = entry->value.load();
+        return ptr && ptr != Expunged();
+    }
+    V* ptr = Reclaimer::Acquire(&entry->value, 1);
+    const bool found = ptr && ptr != Expunged();
+    if (found) {
+        *value = *ptr;
+    }
+    Reclaimer::Release(1);
+    return found;
+}
+
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::TryStore(Entry* entry, const V& value) {
+    V* old = entry->value.load();
+    if (old == Expunged()) {
+        return false;
+    }
+    auto* ptr = new V(value);
+    while (!entry->value.compare_exchange_weak(old, ptr)) {
+        if (old == Expunged()) {
+            delete ptr;
+            return false;
+        }
+    }
+    if (old) {
+        Reclaimer::Retire(old);
     } else {
-        if (!mutable_map_->contains(key)) {
-            mutable_map_->emplace(key, value);
-            operation_count_ = 0;
+        --deleted_count_;
+    }
+    return true;
+}
+
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::TryLoadOrStore(Entry* entry, const V& value, V* actual,
+                                              bool* loaded) {
+    std::unique_ptr<V> ptr;
+    while (!Load(entry, actual)) {
+        if (!ptr) {
+            ptr = std::make_unique<V>(value);
+        }
+        V* expected = nullptr;
+        if (entry->value.compare_exchange_strong(expected, ptr.get())) {
+            ptr.release();
+            --deleted_count_;
+            if (actual) {
+                *actual = value;
+            }
+            *loaded = false;
+            return true;
+        }
+        if (expected == Expunged()) {
+            return false;
+        }
+        // Another thread has stored a value in the meantime, load it.
+    }
+    *loaded = true;
+    return true;
+}
+
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::TryDelete(Entry* entry, bool* deleted) {
+    V* old = entry->value.load();
+    do {
+        if (!old) {
+            *deleted = false;
             return true;
-        } else {
+        }
+        if (old == Expunged()) {
             return false;
         }
+    } while (!entry->value.compare_exchange_weak(old, nullptr));
+    Reclaimer::Retire(old);
+    *deleted = true;
+    return true;
+}
+
+template <class K, class V, class Reclaimer>
+void SyncMap<K, V, Reclaimer>::AddToMutableMap(Snapshot* old_snapshot, const K& key,
+                                               const V& value) {
+    if (mutable_map_.empty()) {
+        Snapshot* new_snapshot = new Snapshot{old_snapshot->read_only, true};
+        snapshot_.store(new_snapshot);
+        Reclaimer::Retire(old_snapshot);
     }
-}
\ No newline at end of file
+    mutable_map_.emplace(key, value);
+    operation_count_ = 0;
+}
+
+template <class K, class V, class Reclaimer>
+void SyncMap<K, V, Reclaimer>::CountOperation(Snapshot* old_snapshot) {
+    if (++operation_count_ >= std::max(kMinOperationsCnt, mutable_map_.size())) {
+        Promote(old_snapshot);
+    }
+}
+
+// Moves the mutable map into a new snapshot. When deleted keys make up half of the snapshot, it
+// is rebuilt without them: each is expunged first, so that a concurrent Store that still finds
+// it in an older snapshot falls back to the mutex.
+template <class K, class V, class Reclaimer>
+void SyncMap<K, V, Reclaimer>::Promote(Snapshot* old_snapshot) {
+    auto read_only = old_snapshot->read_only;
+    if (NeedsCompaction(read_only.Size())) {
+        read_only = {};
+        size_t expunged = 0;
+        old_snapshot->read_only.ForEach([&](const K& key, const std::shared_ptr<Entry>& entry) {
+            V* expected = nullptr;
+            if (entry->value.compare_exchange_strong(expected, Expunged())) {
+                ++expunged;
+            } else if (expected != Expunged()) {
+                read_only.Set(key, entry);
+            }
+        });
+        deleted_count_ -= expunged;
+    }
+    for (const auto& [key, value] : mutable_map_) {
+        read_only.Set(key, std::make_shared<Entry>(new V(value)));
+    }
+
+    Snapshot* new_snapshot = new Snapshot{std::move(read_only), false};
+    snapshot_.store(new_snapshot);
+    Reclaimer::Retire(old_snapshot);
+    mutable_map_.clear();
+    operation_count_ = 0;
+}
+
+template <class K, class V, class Reclaimer>
+bool SyncMap<K, V, Reclaimer>::NeedsCompaction(size_t snapshot_size) const {
+    const auto threshold = std::max(kMinDeletedToCompact, snapshot_size / 2);
+    return deleted_count_.load() >= static_cast<ptrdiff_t>(threshold);
+}
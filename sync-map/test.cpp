@@ -1,5 +1,7 @@
 #include "../hazard-ptr/hazard_ptr.h"
+#include "../hazard-ptr/epoch.h"
 #include "sync_map.h"
+#include "hamt.h"
 
 #include <random>
 #include <unordered_map>
@@ -42,6 +44,119 @@ TEST_CASE("UpgradeToReadOnly") {
     UnregisterThread();
 }
 
+TEST_CASE("StoreDelete") {
+    RegisterThread();
+    SyncMap<int, int> map;
+
+    int value;
+    map.Store(0, 1);
+    REQUIRE(map.Lookup(0, &value));
+    REQUIRE(value == 1);
+    map.Store(0, 2);
+    REQUIRE(map.Lookup(0, &value));
+    REQUIRE(value == 2);
+
+    REQUIRE(map.Delete(0));
+    REQUIRE_FALSE(map.Delete(0));
+    REQUIRE_FALSE(map.Lookup(0, &value));
+    REQUIRE_FALSE(map.Delete(1));
+
+    REQUIRE_FALSE(map.LoadOrStore(0, 3, &value));
+    REQUIRE(value == 3);
+    REQUIRE(map.LoadOrStore(0, 4, &value));
+    REQUIRE(value == 3);
+    REQUIRE_FALSE(map.Insert(0, 5));
+    REQUIRE(map.Insert(1, 5));
+    REQUIRE(map.Lookup(1, &value));
+    REQUIRE(value == 5);
+    UnregisterThread();
+}
+
+TEST_CASE("InsertNonDefaultConstructible") {
+    struct Value {
+        explicit Value(int x) : x{x} {
+        }
+        int x;
+    };
+    RegisterThread();
+    SyncMap<int, Value> map;
+
+    for (auto i = 0; i < 100; ++i) {
+        REQUIRE(map.Insert(i % 10, Value{i}) == (i < 10));
+    }
+    Value value{-1};
+    REQUIRE(map.Lookup(3, &value));
+    REQUIRE(value.x == 3);
+    UnregisterThread();
+}
+
+TEST_CASE("DeleteFromReadOnly") {
+    static constexpr auto kN = 1'000;
+    RegisterThread();
+    SyncMap<int, int> map;
+
+    for (auto round = 0; round < 3; ++round) {
+        for (auto i = 0; i < kN; ++i) {
+            map.Store(i, i + round);
+        }
+        // Enough locked lookups to promote everything into the read-only snapshot.
+        int value;
+        for (auto i = 0; i < 2 * kN; ++i) {
+            REQUIRE(map.Lookup(i % kN, &value));
+            REQUIRE(value == i % kN + round);
+        }
+
+        // Deleting half of the keys compacts the snapshot, the next round stores them again.
+        for (auto i = 1; i < kN; i += 2) {
+            REQUIRE(map.Delete(i));
+        }
+        for (auto i = 0; i < kN; ++i) {
+            REQUIRE(map.Lookup(i, &value) == (i % 2 == 0));
+        }
+        for (auto i = 0; i < kN; i += 2) {
+            REQUIRE(map.Delete(i));
+            REQUIRE_FALSE(map.Lookup(i, &value));
+        }
+    }
+    UnregisterThread();
+}
+
+namespace {
+
+// Counts hash calls: a lookup miss hashes the key once on the lock-free path and again under
+// the mutex.
+std::atomic<int> key_hashes = 0;
+
+struct CountedKey {
+    int value;
+    bool operator==(const CountedKey&) const = default;
+};
+
+}  // namespace
+
+template <>
+struct std::hash<CountedKey> {
+    size_t operator()(const CountedKey& key) const {
+        ++key_hashes;
+        return std::hash<int>{}(key.value);
+    }
+};
+
+TEST_CASE("MissesAfterDeleteAreLockFree") {
+    RegisterThread();
+    SyncMap<CountedKey, int> map;
+
+    int value;
+    REQUIRE(map.Insert({1}, 1));
+    REQUIRE(map.Delete({1}));
+    for (auto i = 0; i < 100; ++i) {
+        key_hashes = 0;
+        REQUIRE_FALSE(map.Lookup({2}, &value));
+        REQUIRE(key_hashes == 1);
+    }
+    UnregisterThread();
+}
+
 TEST_CASE("Stress") {
     std::unordered_map<int, int> std_map;
     SyncMap<int, int> map;
@@ -70,8 +185,54 @@ TEST_CASE("Stress") {
     }
 }
 
+TEST_CASE("PersistentHashMap") {
+    PersistentHashMap<int, int> map;
+    for (auto i = 0; i < 10'000; ++i) {
+        map.Set(i, i);
+    }
+    auto snapshot = map;
+    for (auto i = 0; i < 10'000; i += 2) {
+        map.Set(i, -i);
+    }
+    map.Set(10'000, 0);
+
+    REQUIRE(map.Size() == 10'001);
+    REQUIRE(snapshot.Size() == 10'000);
+    for (auto i = 0; i < 10'000; ++i) {
+        REQUIRE(*snapshot.Find(i) == i);
+        REQUIRE(*map.Find(i) == (i % 2 ? i : -i));
+    }
+    CHECK_FALSE(snapshot.Contains(10'000));
+    CHECK(map.Contains(10'000));
+    CHECK_FALSE(map.Contains(-1));
+}
+
 namespace {
 
+struct ConstantHash {
+    size_t operator()(int) const {
+        return 0;
+    }
+};
+
+}  // namespace
+
+TEST_CASE("PersistentHashMapCollisions") {
+    PersistentHashMap<int, int, ConstantHash> map;
+    for (auto i = 0; i < 100; ++i) {
+        map.Set(i, i);
+    }
+    map.Set(42, 0);
+    REQUIRE(map.Size() == 100);
+    for (auto i = 0; i < 100; ++i) {
+        REQUIRE(*map.Find(i) == (i == 42 ? 0 : i));
+    }
+    CHECK_FALSE(map.Contains(100));
+}
+
+namespace {
+
+template <class Reclaimer>
 struct StressMultiThread {
     void Run() {
         std::vector<std::jthread> threads;
@@ -85,6 +246,25 @@ struct StressMultiThread {
         latch_.count_down();
     }
 
+    void Check() {
+        REQUIRE_FALSE(is_fail.load());
+
+        std::unordered_map<int, int> values;
+        for (const auto& m : inserted) {
+            for (const auto& [k, v] : m) {
+                REQUIRE(values.emplace(k, v).second);
+            }
+        }
+
+        for (const auto& m : looked) {
+            for (const auto& [k, v] : m) {
+                auto it = values.find(k);
+                REQUIRE(it != values.end());
+                REQUIRE(v == it->second);
+            }
+        }
+    }
+
     std::atomic_bool is_fail;
     std::vector<std::unordered_map<int, int>> looked{kNumReaders};
     std::vector<std::unordered_map<int, int>> inserted{kNumWriters};
@@ -139,28 +319,96 @@ private:
     static constexpr auto kNumWriters = 3u;
     static constexpr auto kMaxValue = 10'000;
 
-    SyncMap<int, int> map_;
+    SyncMap<int, int, Reclaimer> map_;
     std::latch latch_{1};
 };
 
 }  // namespace
 
-TEST_CASE_METHOD(StressMultiThread, "StressMultiThread") {
+TEST_CASE_METHOD(StressMultiThread<HazardPointers>, "StressMultiThread") {
     Run();
-    REQUIRE_FALSE(is_fail.load());
+    Check();
+}
 
-    std::unordered_map<int, int> values;
-    for (const auto& m : inserted) {
-        for (const auto& [k, v] : m) {
-            REQUIRE(values.emplace(k, v).second);
-        }
+TEST_CASE_METHOD(StressMultiThread<EpochReclamation>, "StressMultiThread epoch") {
+    Run();
+    Check();
+}
+
+namespace {
+
+// Writers own disjoint key ranges, so each knows the final state of its keys. Values encode their
+// key, so readers can check what they see.
+template <class Reclaimer>
+void RunStoreDelete() {
+    static constexpr auto kNumWriters = 4;
+    static constexpr auto kNumReaders = 4;
+    static constexpr auto kKeysPerWriter = 256;
+    static constexpr auto kNumIterations = 50'000;
+    SyncMap<int, int, Reclaimer> map;
+    std::vector<std::unordered_map<int, int>> expected(kNumWriters);
+    std::atomic writers_finished = 0;
+    std::atomic_bool is_fail = false;
+
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumWriters; ++i) {
+        threads.emplace_back([&, i, &expected = expected[i]] {
+            RegisterThread();
+            std::mt19937 gen(i);
+            std::uniform_int_distribution dist{0, kKeysPerWriter - 1};
+            for (auto j = 0; j < kNumIterations; ++j) {
+                const auto key = i * kKeysPerWriter + dist(gen);
+                if (j % 3 == 0) {
+                    if (map.Delete(key) != expected.contains(key)) {
+                        is_fail = true;
+                    }
+                    expected.erase(key);
+                } else {
+                    map.Store(key, key * kNumIterations + j);
+                    expected[key] = key * kNumIterations + j;
+                }
+            }
+            ++writers_finished;
+            UnregisterThread();
+        });
     }
+    for (auto i = 0; i < kNumReaders; ++i) {
+        threads.emplace_back([&, i] {
+            RegisterThread();
+            std::mt19937 gen(kNumWriters + i);
+            std::uniform_int_distribution dist{0, kNumWriters * kKeysPerWriter - 1};
+            while (writers_finished != kNumWriters) {
+                const auto key = dist(gen);
+                if (int value; map.Lookup(key, &value) && value / kNumIterations != key) {
+                    is_fail = true;
+                }
+            }
+            UnregisterThread();
+        });
+    }
+    threads.clear();
+    REQUIRE_FALSE(is_fail);
 
-    for (const auto& m : looked) {
-        for (const auto& [k, v] : m) {
-            auto it = values.find(k);
-            REQUIRE(it != values.end());
-            REQUIRE(v == it->second);
+    RegisterThread();
+    for (auto i = 0; i < kNumWriters; ++i) {
+        for (auto key = i * kKeysPerWriter; key < (i + 1) * kKeysPerWriter; ++key) {
+            int value;
+            auto it = expected[i].find(key);
+            REQUIRE(map.Lookup(key, &value) == (it != expected[i].end()));
+            if (it != expected[i].end()) {
+                REQUIRE(value == it->second);
+            }
         }
     }
+    UnregisterThread();
+}
+
+}  // namespace
+
+TEST_CASE("StoreDeleteMultiThread") {
+    RunStoreDelete<HazardPointers>();
+}
+
+TEST_CASE("StoreDeleteMultiThread epoch") {
+    RunStoreDelete<EpochReclamation>();
 }
@@ -6,6 +6,7 @@
 #include <algorithm>
 #include <random>
 #include <ranges>
+#include <stdexcept>
 
 #include <catch2/catch_test_macros.hpp>
 
@@ -128,6 +129,208 @@ TEST_CASE("Args") {
     queue.Pop();
 }
 
+TEST_CASE("BraceInit") {
+    TimerQueue<std::vector<int>> queue;
+    queue.Add(kNow(), 3, 4);
+    REQUIRE(queue.Pop() == std::vector{3, 4});
+}
+
+TEST_CASE("EqualDeadlines") {
+    auto at = kNow() + 5ms;
+    TimerQueue<int> queue;
+    for (auto i = 0; i < 100; ++i) {
+        queue.Add(at, i);
+    }
+    for (auto i = 0; i < 100; ++i) {
+        REQUIRE(queue.Pop() == i);
+    }
+}
+
+TEST_CASE("Cancel") {
+    auto start = kNow();
+    TimerQueue<int> queue;
+    auto far = queue.Add(start + 24h, 0);
+    auto late = queue.Add(start + 1s, 1);
+    auto due = queue.Add(start, 2);
+    queue.Add(start + 10ms, 3);
+
+    REQUIRE(queue.Cancel(far));
+    REQUIRE_FALSE(queue.Cancel(far));
+    REQUIRE(queue.Cancel(late));
+    REQUIRE(queue.Pop() == 2);
+    REQUIRE_FALSE(queue.Cancel(due));
+    REQUIRE_FALSE(queue.Cancel({}));
+
+    auto handle = queue.Add(start, 4);
+    REQUIRE(queue.Pop() == 4);
+    REQUIRE(queue.Pop() == 3);
+    REQUIRE_FALSE(queue.Cancel(handle));
+    REQUIRE(kNow() < start + 1s);
+}
+
+TEST_CASE("Order") {
+    static constexpr auto kNumElements = 20'000;
+
+    std::mt19937 gen{42};
+    std::uniform_int_distribution<int> delay{0, 50'000};
+    auto start = kNow();
+    TimerQueue<int> queue{1us};
+    std::vector<std::chrono::system_clock::time_point> deadlines;
+    for (auto i = 0; i < kNumElements; ++i) {
+        deadlines.push_back(start + delay(gen) * 1us);
+        queue.Add(deadlines.back(), i);
+    }
+
+    auto prev = start;
+    for (auto i = 0; i < kNumElements; ++i) {
+        auto at = deadlines[queue.Pop()];
+        REQUIRE(at >= prev);
+        REQUIRE(kNow() >= at);
+        prev = at;
+    }
+}
+
+TEST_CASE("CoarseTick") {
+    auto start = kNow();
+    TimerQueue<int> queue{100ms};
+    queue.Add(start + 30ms, 0);
+    queue.Add(start + 20ms, 1);
+    queue.Add(start + 150ms, 2);
+
+    REQUIRE(queue.Pop() == 1);
+    REQUIRE(kNow() >= start + 20ms);
+    REQUIRE(queue.Pop() == 0);
+    REQUIRE(kNow() >= start + 30ms);
+    REQUIRE(queue.Pop() == 2);
+    REQUIRE(kNow() >= start + 150ms);
+}
+
+TEST_CASE("LongTick") {
+    REQUIRE_THROWS_AS(TimerQueue<int>{0ms}, std::invalid_argument);
+
+    TimerQueue<int> queue{1h};
+    queue.Add(TimerQueue<int>::Clock::time_point::max(), 0);
+    REQUIRE_FALSE(queue.PopUntil(kNow() + 10ms));
+    REQUIRE_FALSE(queue.TryPop());
+}
+
+TEST_CASE("TryPop") {
+    auto start = kNow();
+    TimerQueue<int> queue;
+    REQUIRE_FALSE(queue.TryPop());
+    queue.Add(start + 20ms, 0);
+    queue.Add(start, 1);
+
+    REQUIRE(queue.TryPop() == 1);
+    REQUIRE_FALSE(queue.TryPop());
+    std::this_thread::sleep_for(20ms);
+    REQUIRE(queue.TryPop() == 0);
+}
+
+TEST_CASE("PopUntil") {
+    auto start = kNow();
+    TimerQueue<int> queue;
+    REQUIRE_FALSE(queue.PopUntil(start + 10ms));
+    REQUIRE(kNow() >= start + 10ms);
+
+    queue.Add(start + 50ms, 0);
+    REQUIRE_FALSE(queue.PopUntil(start + 20ms));
+    REQUIRE(kNow() >= start + 20ms);
+    REQUIRE(queue.PopUntil(start + 1s) == 0);
+    auto diff = kNow() - start;
+    REQUIRE(diff >= 50ms);
+    REQUIRE(diff < 1s);
+}
+
+TEST_CASE("PopAllExpired") {
+    auto start = kNow();
+    TimerQueue<int> queue;
+    for (auto i = 0; i < 10; ++i) {
+        queue.Add(start + 10ms, i);
+    }
+    queue.Add(start + 5ms, -1);
+    queue.Add(start + 1s, 10);
+
+    std::vector<int> values;
+    REQUIRE(queue.PopAllExpired(std::back_inserter(values)) == 1);
+    REQUIRE(kNow() >= start + 5ms);
+    REQUIRE(queue.PopAllExpired(std::back_inserter(values), 4) == 4);
+    REQUIRE(values == std::vector{-1, 0, 1, 2, 3});
+    REQUIRE(kNow() >= start + 10ms);
+    REQUIRE(queue.PopAllExpired(std::back_inserter(values)) == 6);
+    REQUIRE(values.back() == 9);
+    REQUIRE(queue.PopAllExpired(std::back_inserter(values), 0) == 0);
+}
+
+TEST_CASE("ManyWaiters") {
+    static constexpr auto kNumConsumers = 4;
+
+    auto start = kNow();
+    TimerQueue<int> queue;
+    std::atomic count = 0;
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumConsumers; ++i) {
+        threads.emplace_back([&] {
+            queue.Pop();
+            ++count;
+        });
+    }
+    std::this_thread::sleep_for(10ms);
+
+    // Only the first timer changes the earliest deadline, the rest are handed over.
+    queue.Add(start + 30ms, 0);
+    for (auto i = 1; i < kNumConsumers; ++i) {
+        queue.Add(start + 40ms, i);
+    }
+    threads.clear();
+    REQUIRE(count == kNumConsumers);
+    REQUIRE(kNow() < start + 1s);
+}
+
+TEST_CASE("StressBatches") {
+    static constexpr auto kNumProducers = 2;
+    static constexpr auto kNumConsumers = 4;
+    static constexpr auto kNumElements = 300'000;
+    static constexpr size_t kBatchSize = 64;
+
+    std::atomic produced = 0;
+    std::atomic consumed = 0;
+    TimerQueue<int> queue;
+    std::vector<std::jthread> threads;
+    for (auto i = 0; i < kNumProducers; ++i) {
+        threads.emplace_back([&] {
+            for (auto i = Inc(&produced); i < kNumElements; i = Inc(&produced)) {
+                queue.Add(kNow(), i);
+            }
+        });
+    }
+    std::vector<int> result(kNumElements);
+    std::atomic stop = false;
+    for (auto t = 0; t < kNumConsumers; ++t) {
+        threads.emplace_back([&] {
+            std::vector<int> batch;
+            while (!stop) {
+                batch.clear();
+                queue.PopAllExpired(std::back_inserter(batch), kBatchSize);
+                std::erase(batch, -1);
+                auto i = consumed.fetch_add(batch.size());
+                std::ranges::copy(batch, result.begin() + i);
+                if (i + batch.size() == kNumElements) {
+                    stop = true;
+                }
+            }
+            // Wakes the next consumer that is still waiting.
+            queue.Add(kNow(), -1);
+        });
+    }
+    threads.clear();
+
+    std::ranges::sort(result);
+    std::vector<int> answer(kNumElements);
+    std::iota(answer.begin(), answer.end(), 0);
+    REQUIRE(result == answer);
+}
+
 TEST_CASE("Stress") {
     static constexpr auto kNumProducers = 2;
     static constexpr auto kNumConsumers = 10;
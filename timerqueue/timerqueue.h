@@ -1,41 +1,361 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <chrono>
 #include <condition_variable>
-#include <map>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <mutex>
+#include <optional>
+#include <stdexcept>
 #include <utility>
+#include <vector>
 
 using namespace std::chrono_literals;
 
+// Hierarchical timing wheel. Time is cut into ticks, level l has 64 slots of 64^l ticks each,
+// and a timer goes to the lowest level whose range covers its distance from the current tick.
+// When the current tick reaches a slot of an upper level, its timers are cascaded down. Timers
+// of the current tick move to a heap ordered by their exact deadlines, so Pop never returns a
+// timer early and equal deadlines come out in the order they were added. Add and Cancel are
+// O(1), nodes are pooled.
 template <class T>
 class TimerQueue {
+    struct Node;
+
 public:
+    using Clock = std::chrono::system_clock;
+
+    // Identifies a timer for Cancel. Stays safe to use after the timer is popped or cancelled.
+    class Handle {
+    public:
+        Handle() = default;
+
+    private:
+        friend class TimerQueue;
+
+        Handle(Node* node, uint64_t id) : node_(node), id_(id) {
+        }
+
+        Node* node_ = nullptr;
+        uint64_t id_ = 0;
+    };
+
+    explicit TimerQueue(Clock::duration tick = 1ms) : tick_(tick), start_(Clock::now()) {
+        if (tick <= tick.zero()) {
+            throw std::invalid_argument{"TimerQueue tick must be positive"};
+        }
+    }
+
+    TimerQueue(const TimerQueue&) = delete;
+    TimerQueue& operator=(const TimerQueue&) = delete;
+
     template <class... Args>
-    void Add(std::chrono::system_clock::time_point at, Args&&... args) {
+    Handle Add(Clock::time_point at, Args&&... args) {
         std::unique_lock<std::mutex> add_elem_lock(edit_queue_);
 
-        queue_.emplace(std::make_pair(at, T{std::forward<Args>(args)...}));
-        waiting_pop_.notify_one();
+        Node* node = NewNode();
+        node->at = at;
+        node->tick = TickOf(at);
+        node->id = ++last_id_;
+        // Braces, so that Add(at, 3, 4) makes a vector {3, 4} and narrowing does not compile.
+        node->value.emplace(T{std::forward<Args>(args)...});
+        // Waiters sleep until the earliest deadline, so a later timer does not concern them.
+        if (waiters_ && at < EarliestDeadline()) {
+            waiting_pop_.notify_one();
+        }
+        Insert(node);
+        return {node, node->id};
+    }
+
+    // Returns false if the timer has already been popped or cancelled.
+    bool Cancel(Handle handle) {
+        std::unique_lock<std::mutex> cancel_lock(edit_queue_);
+
+        Node* node = handle.node_;
+        if (!node || node->id != handle.id_) {
+            return false;
+        }
+        if (node->state == State::kWheel) {
+            Unlink(node);
+            Recycle(node);
+        } else if (node->state == State::kDue) {
+            // Left in the heap, recycled when it reaches the top.
+            node->state = State::kCancelled;
+            node->value.reset();
+        } else {
+            return false;
+        }
+        return true;
     }
 
     T Pop() {
         std::unique_lock<std::mutex> pop_elem_lock(edit_queue_);
 
-        waiting_pop_.wait_until(
-            pop_elem_lock,
-            queue_.empty() ? std::chrono::system_clock::now() + 10s : queue_.begin()->first,
-            [this] {
-                return !queue_.empty() && std::chrono::system_clock::now() >= queue_.begin()->first;
-            });
+        T res = Take(WaitExpired(pop_elem_lock, Clock::time_point::max()));
+        HandOff();
+        return res;
+    }
+
+    // Returns the earliest timer if it has expired, without blocking.
+    std::optional<T> TryPop() {
+        std::unique_lock<std::mutex> pop_elem_lock(edit_queue_);
 
-        T res(std::move(queue_.begin()->second));
-        queue_.erase(queue_.begin());
+        const auto now = Clock::now();
+        Advance(TickOf(now));
+        if (Node* node = EarliestDue(); node && node->at <= now) {
+            return Take(node);
+        }
+        return std::nullopt;
+    }
+
+    // Like Pop, but gives up at deadline.
+    std::optional<T> PopUntil(Clock::time_point deadline) {
+        std::unique_lock<std::mutex> pop_elem_lock(edit_queue_);
+
+        std::optional<T> res;
+        if (Node* node = WaitExpired(pop_elem_lock, deadline)) {
+            res.emplace(Take(node));
+        }
+        HandOff();
         return res;
     }
 
+    // Blocks like Pop, then writes up to max expired values to out in deadline order under one
+    // lock. Returns their number.
+    template <class OutputIt>
+    size_t PopAllExpired(OutputIt out, size_t max = SIZE_MAX) {
+        if (!max) {
+            return 0;
+        }
+        std::unique_lock<std::mutex> pop_elem_lock(edit_queue_);
+
+        *out = Take(WaitExpired(pop_elem_lock, Clock::time_point::max()));
+        ++out;
+        size_t count = 1;
+        const auto now = Clock::now();
+        for (Node* node; count < max && (node = EarliestDue()) && node->at <= now; ++count) {
+            *out = Take(node);
+            ++out;
+        }
+        HandOff();
+        return count;
+    }
+
 private:
+    static constexpr int kSlotBits = 6;
+    static constexpr size_t kSlots = size_t{1} << kSlotBits;
+    // With 1ms ticks the wheel spans two years, later timers wait in the top level and are
+    // put back there on every cascade until they are close enough.
+    static constexpr int kLevels = 6;
+
+    enum class State : uint8_t { kFree, kWheel, kDue, kCancelled };
+
+    struct Node {
+        Clock::time_point at;
+        uint64_t tick = 0;
+        // Unique per Add, also orders equal deadlines.
+        uint64_t id = 0;
+        Node* prev = nullptr;
+        Node* next = nullptr;
+        uint8_t level = 0;
+        uint8_t slot = 0;
+        State state = State::kFree;
+        std::optional<T> value;
+    };
+
+    static bool Later(const Node* lhs, const Node* rhs) {
+        return std::pair{lhs->at, lhs->id} > std::pair{rhs->at, rhs->id};
+    }
+
+    uint64_t TickOf(Clock::time_point at) const {
+        return at <= start_ ? 0 : static_cast<uint64_t>((at - start_) / tick_);
+    }
+
+    // Saturates, a coarse tick puts the upper levels of the wheel beyond the clock range.
+    Clock::time_point TimeOf(uint64_t tick) const {
+        if (tick > static_cast<uint64_t>((Clock::time_point::max() - start_) / tick_)) {
+            return Clock::time_point::max();
+        }
+        return start_ + tick_ * tick;
+    }
+
+    Node* NewNode() {
+        if (free_.empty()) {
+            return &nodes_.emplace_back();
+        }
+        Node* node = free_.back();
+        free_.pop_back();
+        return node;
+    }
+
+    void Recycle(Node* node) {
+        node->state = State::kFree;
+        node->value.reset();
+        free_.push_back(node);
+    }
+
+    void Insert(Node* node) {
+        if (node->tick <= current_) {
+            node->state = State::kDue;
+            due_.push_back(node);
+            std::push_heap(due_.begin(), due_.end(), Later);
+            return;
+        }
+
+        const auto delta = node->tick - current_;
+        auto level = 0;
+        while (level + 1 < kLevels && delta >> (kSlotBits * (level + 1))) {
+            ++level;
+        }
+        auto tick = node->tick;
+        if (level + 1 == kLevels && delta >> (kSlotBits * kLevels)) {
+            tick = current_ + (uint64_t{1} << (kSlotBits * kLevels)) - 1;
+        }
+
+        const auto slot = (tick >> (kSlotBits * level)) & (kSlots - 1);
+        node->state = State::kWheel;
+        node->level = level;
+        node->slot = slot;
+        node->prev = nullptr;
+        node->next = std::exchange(slots_[level][slot], node);
+        if (node->next) {
+            node->next->prev = node;
+        }
+        occupied_[level] |= uint64_t{1} << slot;
+        ++in_wheel_;
+    }
+
+    void Unlink(Node* node) {
+        if (node->next) {
+            node->next->prev = node->prev;
+        }
+        if (node->prev) {
+            node->prev->next = node->next;
+        } else if (!(slots_[node->level][node->slot] = node->next)) {
+            occupied_[node->level] &= ~(uint64_t{1} << node->slot);
+        }
+        --in_wheel_;
+    }
+
+    // The first tick after current_ at which an occupied slot is processed.
+    uint64_t NextEvent() const {
+        auto event = UINT64_MAX;
+        for (auto level = 0; level < kLevels; ++level) {
+            if (!occupied_[level]) {
+                continue;
+            }
+            const auto shift = kSlotBits * level;
+            const auto block = current_ >> shift;
+            const auto pos = static_cast<int>((block + 1) & (kSlots - 1));
+            const auto distance = std::countr_zero(std::rotr(occupied_[level], pos));
+            event = std::min(event, (block + 1 + distance) << shift);
+        }
+        return event;
+    }
+
+    // Moves the wheel to target, jumping over ticks with nothing to process.
+    void Advance(uint64_t target) {
+        while (current_ < target) {
+            if (!in_wheel_) {
+                current_ = target;
+                return;
+            }
+            current_ = std::min(target, NextEvent());
+
+            // Upper levels go first, their timers may land in the level 0 slot of this tick.
+            for (auto level = kLevels - 1; level >= 0; --level) {
+                const auto shift = kSlotBits * level;
+                if (current_ & ((uint64_t{1} << shift) - 1)) {
+                    continue;
+                }
+                const auto slot = (current_ >> shift) & (kSlots - 1);
+                Node* node = std::exchange(slots_[level][slot], nullptr);
+                occupied_[level] &= ~(uint64_t{1} << slot);
+                while (node) {
+                    Node* next = node->next;
+                    --in_wheel_;
+                    Insert(node);
+                    node = next;
+                }
+            }
+        }
+    }
+
+    // Returns the earliest expired timer, or nullptr once deadline has passed.
+    Node* WaitExpired(std::unique_lock<std::mutex>& lock, Clock::time_point deadline) {
+        while (true) {
+            const auto now = Clock::now();
+            Advance(TickOf(now));
+            if (Node* node = EarliestDue(); node && node->at <= now) {
+                return node;
+            }
+            if (now >= deadline) {
+                return nullptr;
+            }
+
+            const auto wake_at = std::min(deadline, EarliestDeadline());
+            ++waiters_;
+            if (wake_at == Clock::time_point::max()) {
+                waiting_pop_.wait(lock);
+            } else {
+                waiting_pop_.wait_until(lock, wake_at);
+            }
+            --waiters_;
+        }
+    }
+
+    // Add wakes a single waiter for a new earliest timer, and the others keep sleeping until
+    // older deadlines. So a thread that leaves the wait passes the turn to the next one, which
+    // picks the earliest remaining timer.
+    void HandOff() {
+        if (waiters_ && (in_wheel_ || !due_.empty())) {
+            waiting_pop_.notify_one();
+        }
+    }
+
+    T Take(Node* node) {
+        std::pop_heap(due_.begin(), due_.end(), Later);
+        due_.pop_back();
+        T res(std::move(*node->value));
+        Recycle(node);
+        return res;
+    }
+
+    // The deadline of the earliest due timer, or the start of the next tick with work in the
+    // wheel, which is never later than the timers there.
+    Clock::time_point EarliestDeadline() {
+        if (Node* node = EarliestDue()) {
+            return node->at;
+        }
+        return in_wheel_ ? TimeOf(NextEvent()) : Clock::time_point::max();
+    }
+
+    // Drops cancelled timers from the top of the heap.
+    Node* EarliestDue() {
+        while (!due_.empty() && due_.front()->state == State::kCancelled) {
+            std::pop_heap(due_.begin(), due_.end(), Later);
+            Recycle(due_.back());
+            due_.pop_back();
+        }
+        return due_.empty() ? nullptr : due_.front();
+    }
+
+    const Clock::duration tick_;
+    const Clock::time_point start_;
+    uint64_t current_ = 0;
+    uint64_t last_id_ = 0;
+    size_t in_wheel_ = 0;
+    size_t waiters_ = 0;
+    std::array<std::array<Node*, kSlots>, kLevels> slots_{};
+    std::array<uint64_t, kLevels> occupied_{};
+    std::vector<Node*> due_;
+    std::deque<Node> nodes_;
+    std::vector<Node*> free_;
+
     std::mutex edit_queue_;
     std::condition_variable waiting_pop_;
-    mutable std::map<std::chrono::system_clock::time_point, T> queue_;
 };